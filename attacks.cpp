@@ -1,130 +1,342 @@
 #include "attacks.h"
+#include "pext.h"
 #include "random.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+  // The tables that don't depend on the magics, generated at compile time.
+  // The arrays of attacks.h are constant initialized from them below, so
+  // they are in the binary and nothing is computed at startup
+  struct AttackTables {
+    uint64_t king[Square::SQ_NB];
+    uint64_t knight[Square::SQ_NB];
+    uint64_t pawn[Color::COLOR_NB][Square::SQ_NB];
+    // The file, rank, diagonal and anti-diagonal of a square, without it
+    uint64_t line_ex[4][Square::SQ_NB];
+    uint64_t front[Color::COLOR_NB][Square::SQ_NB];
+    uint64_t neighbouring_files[Square::FILE_NB];
+    uint64_t passed_pawn[Color::COLOR_NB][Square::SQ_NB];
+    uint64_t pawn_attack_span[Color::COLOR_NB][Square::SQ_NB];
+    uint64_t slider_masks[2][Square::SQ_NB]; // Rook, bishop
+    uint64_t sq_between[Square::SQ_NB][Square::SQ_NB];
+    uint64_t line_between[Square::SQ_NB][Square::SQ_NB];
+  };
+
+  // The square on file f and rank r, if it is on the board
+  constexpr uint64_t square_bb(int f, int r)
+  {
+    return ((f | r) & ~7) ? 0 : 1ULL << (8 * r + f);
+  }
+
+  constexpr AttackTables make_attack_tables()
+  {
+    AttackTables t = {};
+    // The eight directions, the two of each line next to each other
+    const int Dirs[8][2] = {
+      { 0, 1 }, { 0, -1 }, { 1, 0 }, { -1, 0 }, { 1, 1 }, { -1, -1 }, { 1, -1 }, { -1, 1 }
+    };
+    const int Jumps[8][2] = {
+      { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 }
+    };
+
+    for (int f = 0; f < Square::FILE_NB; ++f)
+      t.neighbouring_files[f] = (f > 0 ? Bitboard::FileAMask << (f - 1) : 0)
+        | (f < 7 ? Bitboard::FileAMask << (f + 1) : 0);
+
+    for (int sq = 0; sq < Square::SQ_NB; ++sq) {
+      const int F = sq & 7, R = sq >> 3;
+      for (int i = 0; i < 8; ++i) {
+        t.king[sq] |= square_bb(F + Dirs[i][0], R + Dirs[i][1]);
+        t.knight[sq] |= square_bb(F + Jumps[i][0], R + Jumps[i][1]);
+      }
+      t.pawn[Color::WHITE][sq] = square_bb(F - 1, R + 1) | square_bb(F + 1, R + 1);
+      t.pawn[Color::BLACK][sq] = square_bb(F - 1, R - 1) | square_bb(F + 1, R - 1);
+
+      // Walk each direction, the squares passed being between the square
+      // and the next one
+      for (int d = 0; d < 8; ++d) {
+        uint64_t between = 0;
+        for (int f = F + Dirs[d][0], r = R + Dirs[d][1]; square_bb(f, r);
+             f += Dirs[d][0], r += Dirs[d][1]) {
+          t.sq_between[sq][8 * r + f] = between;
+          between |= square_bb(f, r);
+        }
+        t.line_ex[d / 2][sq] |= between;
+      }
+      for (int d = 0; d < 8; ++d)
+        for (int f = F + Dirs[d][0], r = R + Dirs[d][1]; square_bb(f, r);
+             f += Dirs[d][0], r += Dirs[d][1])
+          t.line_between[sq][8 * r + f] = t.line_ex[d / 2][sq] | square_bb(F, R);
+
+      // The squares of the edges decide no slider attacks, unless the
+      // slider is on that edge
+      const uint64_t Edges = (F != 0 ? Bitboard::FileAMask : 0) | (F != 7 ? Bitboard::FileHMask : 0)
+        | (R != 0 ? Bitboard::Rank1Mask : 0) | (R != 7 ? Bitboard::Rank8Mask : 0);
+      t.slider_masks[0][sq] = (t.line_ex[0][sq] | t.line_ex[1][sq]) & ~Edges;
+      t.slider_masks[1][sq] = (t.line_ex[2][sq] | t.line_ex[3][sq]) & ~Edges;
+
+      t.front[Color::WHITE][sq] = R < 7 ? Bitboard::Universe << (8 * (R + 1)) : 0;
+      t.front[Color::BLACK][sq] = (1ULL << (8 * R)) - 1;
+      for (int c = Color::WHITE; c <= Color::BLACK; ++c) {
+        t.passed_pawn[c][sq] = t.front[c][sq]
+          & ((Bitboard::FileAMask << F) | t.neighbouring_files[F]);
+        t.pawn_attack_span[c][sq] = t.front[c][sq] & t.neighbouring_files[F];
+      }
+    }
+    return t;
+  }
+
+  constexpr AttackTables Tables = make_attack_tables();
+}
+
+// The elements a[0] to a[63] of an array, and the rows a[0] to a[63] of a
+// two-dimensional one, to initialize the arrays of attacks.h with
+#define SQ8(a, r) a[8 * r], a[8 * r + 1], a[8 * r + 2], a[8 * r + 3], \
+  a[8 * r + 4], a[8 * r + 5], a[8 * r + 6], a[8 * r + 7]
+#define SQ64(a) SQ8(a, 0), SQ8(a, 1), SQ8(a, 2), SQ8(a, 3), \
+  SQ8(a, 4), SQ8(a, 5), SQ8(a, 6), SQ8(a, 7)
+#define ROW8(a, r) { SQ64(a[8 * r]) }, { SQ64(a[8 * r + 1]) }, { SQ64(a[8 * r + 2]) }, \
+  { SQ64(a[8 * r + 3]) }, { SQ64(a[8 * r + 4]) }, { SQ64(a[8 * r + 5]) }, \
+  { SQ64(a[8 * r + 6]) }, { SQ64(a[8 * r + 7]) }
+#define ROW64(a) ROW8(a, 0), ROW8(a, 1), ROW8(a, 2), ROW8(a, 3), \
+  ROW8(a, 4), ROW8(a, 5), ROW8(a, 6), ROW8(a, 7)
 
 namespace Attacks {
-  uint64_t KnightAttacks[Square::SQ_NB];
-  uint64_t KingAttacks[Square::SQ_NB];
-  uint64_t RankMaskEx[Square::SQ_NB];
-  uint64_t FileMaskEx[Square::SQ_NB];
-  uint64_t DiagMaskEx[Square::SQ_NB];
-  uint64_t ADiagMaskEx[Square::SQ_NB];
-  uint64_t PawnAttacks[Color::COLOR_NB][Square::SQ_NB];
-  uint64_t FrontSquares[Color::COLOR_NB][Square::SQ_NB] = { { 0 }, { 0 } };
+  uint64_t KnightAttacks[Square::SQ_NB] = { SQ64(Tables.knight) };
+  uint64_t KingAttacks[Square::SQ_NB] = { SQ64(Tables.king) };
+  uint64_t RankMaskEx[Square::SQ_NB] = { SQ64(Tables.line_ex[1]) };
+  uint64_t FileMaskEx[Square::SQ_NB] = { SQ64(Tables.line_ex[0]) };
+  uint64_t DiagMaskEx[Square::SQ_NB] = { SQ64(Tables.line_ex[2]) };
+  uint64_t ADiagMaskEx[Square::SQ_NB] = { SQ64(Tables.line_ex[3]) };
+  uint64_t PawnAttacks[Color::COLOR_NB][Square::SQ_NB] = {
+    { SQ64(Tables.pawn[Color::WHITE]) }, { SQ64(Tables.pawn[Color::BLACK]) }
+  };
+  uint64_t FrontSquares[Color::COLOR_NB][Square::SQ_NB] = {
+    { SQ64(Tables.front[Color::WHITE]) }, { SQ64(Tables.front[Color::BLACK]) }
+  };
 
   uint64_t RTables[0x16200]; // 708 kB
   uint64_t * RAttacks[Square::SQ_NB];
-  uint64_t RMasks[Square::SQ_NB];
+  uint64_t RMasks[Square::SQ_NB] = { SQ64(Tables.slider_masks[0]) };
   uint64_t BTables[0x12C0]; // 37 kB
   uint64_t * BAttacks[Square::SQ_NB];
-  uint64_t BMasks[Square::SQ_NB];
-  uint64_t SqBetween[Square::SQ_NB][Square::SQ_NB];
-  uint64_t LineBetween[Square::SQ_NB][Square::SQ_NB];
-  uint64_t NeighbouringFiles[Square::FILE_NB] = { 0 };
-  uint64_t PassedPawnMask[Color::COLOR_NB][Square::SQ_NB];
-  uint64_t PawnAttackSpan[Color::COLOR_NB][Square::SQ_NB];
+  uint64_t BMasks[Square::SQ_NB] = { SQ64(Tables.slider_masks[1]) };
+  uint64_t SqBetween[Square::SQ_NB][Square::SQ_NB] = { ROW64(Tables.sq_between) };
+  uint64_t LineBetween[Square::SQ_NB][Square::SQ_NB] = { ROW64(Tables.line_between) };
+  uint64_t NeighbouringFiles[Square::FILE_NB] = { SQ8(Tables.neighbouring_files, 0) };
+  uint64_t PassedPawnMask[Color::COLOR_NB][Square::SQ_NB] = {
+    { SQ64(Tables.passed_pawn[Color::WHITE]) }, { SQ64(Tables.passed_pawn[Color::BLACK]) }
+  };
+  uint64_t PawnAttackSpan[Color::COLOR_NB][Square::SQ_NB] = {
+    { SQ64(Tables.pawn_attack_span[Color::WHITE]) }, { SQ64(Tables.pawn_attack_span[Color::BLACK]) }
+  };
+#ifdef USE_PEXT
+  uint64_t RPextTables[0x19000]; // 800 kB
+  uint64_t * RPextAttacks[Square::SQ_NB];
+  uint64_t BPextTables[0x1480]; // 41 kB
+  uint64_t * BPextAttacks[Square::SQ_NB];
+#endif
 
-  void init()
-  {
-    Square::Type sq;
-    for (sq = Square::A1; sq < Square::SQ_NB; ++sq) {
-      using namespace Bitboard;
-      RankMaskEx[sq] = RankMask[Square::rank_of(sq)] & ~sq_mask(sq);
-      FileMaskEx[sq] = FileMask[Square::file_of(sq)] & ~sq_mask(sq);
-      DiagMaskEx[sq] = DiagMask[Square::diag_of(sq)] & ~sq_mask(sq);
-      ADiagMaskEx[sq] = ADiagMask[Square::adiag_of(sq)] & ~sq_mask(sq);
+  namespace {
+    // The slider tables can be kept in a file, named by the environment
+    // variable YAKA_TABLES. A process that finds no valid file computes the
+    // tables and writes one; the others map it read-only instead of
+    // computing them, so that startup is a page-in and all processes share
+    // the tables through the page cache. The header fills a cache line to
+    // keep the mapped tables aligned
+    struct TableFileHeader {
+      char magic[8];
+      uint64_t signature;  // Identifies the magics and table layout of the build
+      uint64_t bytes;      // Size of the tables after the header
+      uint64_t padding[5];
+    };
+    static_assert(sizeof(TableFileHeader) == 64, "Table file header must be 64 bytes");
+
+    const char TableFileMagic[8] = { 'Y', 'A', 'K', 'A', 'T', 'B', 'L', 'S' };
+    const uint64_t TableFileVersion = 1;
+
+    // The tables in the file, one after the other, and the pointers of the
+    // squares into them
+    struct TableRegion {
+      uint64_t * table;
+      size_t bytes;
+      uint64_t ** attacks;
+    };
+    const TableRegion Regions[] = {
+      { RTables, sizeof(RTables), RAttacks },
+      { BTables, sizeof(BTables), BAttacks },
+#ifdef USE_PEXT
+      { RPextTables, sizeof(RPextTables), RPextAttacks },
+      { BPextTables, sizeof(BPextTables), BPextAttacks },
+#endif
+    };
+
+    size_t tables_bytes()
+    {
+      size_t bytes = 0;
+      for (const TableRegion& r : Regions)
+        bytes += r.bytes;
+      return bytes;
     }
 
-    // Initialize all "fancy" magic bitboards
-    RAttacks[0] = RTables;  // Set first offset
-    BAttacks[0] = BTables;  // Set first offset
+    // FNV-1a hash of all the tables are computed from
+    uint64_t table_signature()
+    {
+      uint64_t h = 0xCBF29CE484222325ULL;
+      auto add = [&h](const void* p, size_t n) {
+        for (size_t i = 0; i < n; ++i)
+          h = (h ^ ((const unsigned char*)p)[i]) * 0x100000001B3ULL;
+      };
+      add(&TableFileVersion, sizeof(TableFileVersion));
+      add(RMagics, Square::SQ_NB * sizeof(RMagics[0]));
+      add(RShift, Square::SQ_NB * sizeof(RShift[0]));
+      add(BMagics, Square::SQ_NB * sizeof(BMagics[0]));
+      add(BShift, Square::SQ_NB * sizeof(BShift[0]));
+      for (const TableRegion& r : Regions)
+        add(&r.bytes, sizeof(r.bytes));
+      return h;
+    }
 
-    for (sq = Square::A1; sq < Square::SQ_NB; ++sq) {
-      using namespace Bitboard;
-      init_piece(Piece::ROOK, sq);
-      init_piece(Piece::BISHOP, sq);
-
-      KingAttacks[sq] = king_attacks(sq_mask(sq));
-      KnightAttacks[sq] = knight_attacks(sq_mask(sq));
-
-      if (Square::rank_of(sq) != Square::RANK_8)
-        FrontSquares[Color::WHITE][sq] =
-        north_fill(RankMask[Square::rank_of(sq) + 1]);
-      if (Square::rank_of(sq) != Square::RANK_1)
-        FrontSquares[Color::BLACK][sq] =
-        south_fill(RankMask[Square::rank_of(sq) - 1]);
-
-      PassedPawnMask[Color::WHITE][sq] = north_fill(sq_mask(sq));
-      PassedPawnMask[Color::BLACK][sq] = south_fill(sq_mask(sq));
-      if (Square::file_of(sq) != Square::FILE_H) {
-        NeighbouringFiles[Square::file_of(sq)] |= FileMask[Square::file_of(sq + 1)];
-        PassedPawnMask[Color::WHITE][sq] |= north_fill(sq_mask(sq + 1));
-        PassedPawnMask[Color::BLACK][sq] |= south_fill(sq_mask(sq + 1));
+    bool is_valid(const TableFileHeader& header)
+    {
+      return !std::memcmp(header.magic, TableFileMagic, sizeof(TableFileMagic))
+        && (header.signature == table_signature()) && (header.bytes == tables_bytes());
+    }
+
+    // The start of the table of the next square, right after the one of
+    // this square
+    void init_layout(Piece::PieceType pt, Square::Type sq)
+    {
+      uint64_t ** Attacks = pt == Piece::ROOK ? RAttacks : BAttacks;
+      const count_t * Shift = pt == Piece::ROOK ? RShift : BShift;
+
+      if (sq < Square::H8)
+        Attacks[sq + 1] = Attacks[sq] + (1ULL << (64 - Shift[sq]));
+#ifdef USE_PEXT
+      const uint64_t *Masks = pt == Piece::ROOK ? RMasks : BMasks;
+      uint64_t ** PextAttacks = pt == Piece::ROOK ? RPextAttacks : BPextAttacks;
+      if (sq < Square::H8)
+        PextAttacks[sq + 1] = PextAttacks[sq] + (1ULL << Bitboard::bit_count(Masks[sq]));
+#endif
+    }
+
+    // Use the tables of a valid table file
+    bool map_table_file(const char* filename)
+    {
+      TableFileHeader header;
+#ifdef _WIN32
+      // Read into the tables of this process
+      std::ifstream in(filename, std::ios::binary);
+      if (!in.read((char*)&header, sizeof(header)) || !is_valid(header))
+        return false;
+      for (const TableRegion& r : Regions)
+        if (!in.read((char*)r.table, r.bytes))
+          return false;
+#else
+      const size_t Bytes = sizeof(header) + tables_bytes();
+      int fd = open(filename, O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size != Bytes)) {
+        close(fd);
+        return false;
       }
-      if (Square::file_of(sq) != Square::FILE_A) {
-        NeighbouringFiles[Square::file_of(sq)] |= FileMask[Square::file_of(sq - 1)];
-        PassedPawnMask[Color::WHITE][sq] |= north_fill(sq_mask(sq - 1));
-        PassedPawnMask[Color::BLACK][sq] |= south_fill(sq_mask(sq - 1));
+      void* p = mmap(nullptr, Bytes, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED)
+        return false;
+      std::memcpy(&header, p, sizeof(header));
+      if (!is_valid(header)) {
+        munmap(p, Bytes);
+        return false;
       }
 
-      PassedPawnMask[Color::WHITE][sq] &= ~RankMask[Square::rank_of(sq)];
-      PassedPawnMask[Color::BLACK][sq] &= ~RankMask[Square::rank_of(sq)];
-      PawnAttackSpan[Color::WHITE][sq] = PassedPawnMask[Color::WHITE][sq] & NeighbouringFiles[Square::file_of(sq)];
-      PawnAttackSpan[Color::BLACK][sq] = PassedPawnMask[Color::BLACK][sq] & NeighbouringFiles[Square::file_of(sq)];
-
-      // Initialize pawn attacks
-      PawnAttacks[Color::WHITE][sq] = pawn_attacks<Color::WHITE>(sq_mask(sq));
-      PawnAttacks[Color::BLACK][sq] = pawn_attacks<Color::BLACK>(sq_mask(sq));
-
-      for (Square::Type sq2 = Square::A1; sq2 < Square::SQ_NB; ++sq2) {
-        SqBetween[sq][sq2] = LineBetween[sq][sq2] = 0;
-
-        if (FileMaskEx[sq] & sq_mask(sq2)) {
-          SqBetween[sq][sq2] = file_attacks(sq, sq_mask(sq2));
-          SqBetween[sq][sq2] &= file_attacks(sq2, sq_mask(sq));
-          assert(Square::file_of(sq) == Square::file_of(sq2));
-          LineBetween[sq][sq2] = FileMask[Square::file_of(sq)];
-        } else if (RankMaskEx[sq] & sq_mask(sq2)) {
-          SqBetween[sq][sq2] = rank_attacks(sq, sq_mask(sq2));
-          SqBetween[sq][sq2] &= rank_attacks(sq2, sq_mask(sq));
-          assert(Square::rank_of(sq) == Square::rank_of(sq2));
-          LineBetween[sq][sq2] = RankMask[Square::rank_of(sq)];
-        } else if (DiagMaskEx[sq] & sq_mask(sq2)) {
-          SqBetween[sq][sq2] = diag_attacks(sq, sq_mask(sq2));
-          SqBetween[sq][sq2] &= diag_attacks(sq2, sq_mask(sq));
-          assert(Square::diag_of(sq) == Square::diag_of(sq2));
-          LineBetween[sq][sq2] = DiagMask[Square::diag_of(sq)];
-        } else if (ADiagMaskEx[sq] & sq_mask(sq2)) {
-          SqBetween[sq][sq2] = adiag_attacks(sq, sq_mask(sq2));
-          SqBetween[sq][sq2] &= adiag_attacks(sq2, sq_mask(sq));
-          assert(Square::adiag_of(sq) == Square::adiag_of(sq2));
-          LineBetween[sq][sq2] = ADiagMask[Square::adiag_of(sq)];
-        }
+      // Move the pointers of the squares into the mapping, which is kept
+      // for the life of the process
+      const char* base = (const char*)p + sizeof(header);
+      for (const TableRegion& r : Regions) {
+        for (int sq = 0; sq < Square::SQ_NB; ++sq)
+          r.attacks[sq] = (uint64_t*)base + (r.attacks[sq] - r.table);
+        base += r.bytes;
+      }
+#endif
+      return true;
+    }
+
+    // Write the tables, through a temporary file renamed at the end, so
+    // that other processes never see a partial file
+    void save_table_file(const char* filename)
+    {
+      TableFileHeader header;
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, TableFileMagic, sizeof(TableFileMagic));
+      header.signature = table_signature();
+      header.bytes = tables_bytes();
+
+      const std::string TmpName = std::string(filename) + "." + std::to_string(getpid()) + ".tmp";
+      std::ofstream out(TmpName, std::ios::binary);
+      out.write((const char*)&header, sizeof(header));
+      for (const TableRegion& r : Regions)
+        out.write((const char*)r.table, r.bytes);
+      out.close();
+      if (!out || (std::rename(TmpName.c_str(), filename) != 0))
+        std::remove(TmpName.c_str());
+    }
+  }
 
-        assert(!(SqBetween[sq][sq2] & sq_mask(sq, sq2)));
+  void init()
+  {
+    // The other tables are generated at compile time. The slider tables
+    // are laid out here, as the pointers are relocated into a mapped table
+    // file, and filled unless that file has them
+    Square::Type sq;
+    RAttacks[0] = RTables;  // Set first offset
+    BAttacks[0] = BTables;  // Set first offset
+#ifdef USE_PEXT
+    RPextAttacks[0] = RPextTables;
+    BPextAttacks[0] = BPextTables;
+#endif
+    for (sq = Square::A1; sq < Square::SQ_NB; ++sq) {
+      init_layout(Piece::ROOK, sq);
+      init_layout(Piece::BISHOP, sq);
+    }
+
+    const char* TableFile = std::getenv("YAKA_TABLES");
+    if (!TableFile || !map_table_file(TableFile)) {
+      for (sq = Square::A1; sq < Square::SQ_NB; ++sq) {
+        init_piece(Piece::ROOK, sq);
+        init_piece(Piece::BISHOP, sq);
       }
+      if (TableFile)
+        save_table_file(TableFile);
     }
   }
 
 
+  // Fill the tables of a square, laid out by init_layout()
   void init_piece(Piece::PieceType pt, Square::Type sq)
   {
-    uint64_t *Masks = pt == Piece::ROOK ? RMasks : BMasks;
+    const uint64_t *Masks = pt == Piece::ROOK ? RMasks : BMasks;
     const uint64_t * Magics = pt == Piece::ROOK ? RMagics : BMagics;
     uint64_t ** Attacks = pt == Piece::ROOK ? RAttacks : BAttacks;
     uint64_t(*calc_attacks)(Square::Type, uint64_t) =
       pt == Piece::ROOK ? calc_rook_attacks : calc_bishop_attacks;
     const count_t * Shift = pt == Piece::ROOK ? RShift : BShift;
 
-    Masks[sq] = calc_attacks(sq, 0) & ~Bitboard::sq_mask(sq);
-    if (Square::file_of(sq) != Square::FILE_A)
-      Masks[sq] &= ~Bitboard::FileAMask;
-    if (Square::file_of(sq) != Square::FILE_H)
-      Masks[sq] &= ~Bitboard::FileHMask;
-    if (Square::rank_of(sq) != Square::RANK_1)
-      Masks[sq] &= ~Bitboard::Rank1Mask;
-    if (Square::rank_of(sq) != Square::RANK_8)
-      Masks[sq] &= ~Bitboard::Rank8Mask;
-
     const size_t TableSize = 1ULL << (64 - Shift[sq]);
     std::memset(Attacks[sq], 0, TableSize * sizeof(uint64_t));
 
@@ -136,7 +348,16 @@ namespace Attacks {
       Attacks[sq][index] = calc_attacks(sq, occ);
     } while (occ = next_subset(Masks[sq], occ));
 
-    if (sq < Square::H8)
-      Attacks[sq + 1] = Attacks[sq] + TableSize;
+#ifdef USE_PEXT
+    // The subsets of the mask come in the order of their pext index, so
+    // the table is just filled in that order, with 2^bits entries
+    uint64_t ** PextAttacks = pt == Piece::ROOK ? RPextAttacks : BPextAttacks;
+    size_t index = 0;
+    occ = 0;
+    do {
+      PextAttacks[sq][index++] = calc_attacks(sq, occ);
+    } while (occ = next_subset(Masks[sq], occ));
+    assert(index == (1ULL << Bitboard::bit_count(Masks[sq])));
+#endif
   }
 }
\ No newline at end of file
@@ -3,9 +3,29 @@
 #include "position.h"
 #include "movegen.h"
 #include "evaluator.h"
+#include "leafbatch.h"
+#include "pext.h"
+#include "misc.h"
 #include <sstream>
 #include <cmath>
-#include <malloc.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#ifdef _WIN32
+#include <windows.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 Benchmarker::Benchmarker(Position& pos_, std::ostream& os_, std::istream& is)
   : pos(pos_), os(os_)
@@ -21,36 +41,227 @@ Benchmarker::Benchmarker(Position& pos_, std::ostream& os_, std::istream& is)
 
 PerftBench::~PerftBench()
 {
-  if (PerftHash != nullptr)
-    free(PerftHash);
+  release_hash();
 }
-void PerftBench::allocate_hash(int power2_size)
+
+void PerftBench::release_hash()
+{
+  if (PerftHash == nullptr)
+    return;
+#ifdef _WIN32
+  VirtualFree(PerftHash, 0, MEM_RELEASE);
+#else
+  munmap(PerftHash, hash_bytes);
+#endif
+  PerftHash = nullptr;
+}
+
+// Allocate a table of 'mb' megabytes. The memory is mapped directly, so it
+// comes page aligned and zeroed, and pages of a large table that perft
+// never reaches aren't touched
+bool PerftBench::allocate_hash(size_t mb)
+{
+  release_hash();
+  n_buckets = (mb * 1024 * 1024) / sizeof(PerftBucket);
+  if (n_buckets == 0)
+    return false;
+  hash_bytes = n_buckets * sizeof(PerftBucket);
+
+#ifdef _WIN32
+  PerftHash = (PerftBucket*)VirtualAlloc(nullptr, hash_bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  void* p = mmap(nullptr, hash_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+  if (p != MAP_FAILED)
+    madvise(p, hash_bytes, MADV_HUGEPAGE);
+#endif
+  PerftHash = p == MAP_FAILED ? nullptr : (PerftBucket*)p;
+#endif
+  return PerftHash != nullptr;
+}
+
+// Map the hash onto [0, n_buckets), the same way the transposition table
+// does, so that the table may be of any size
+inline size_t PerftBench::bucket(key_t hash) const
 {
-  PerftHash = (PerftHashTable*)calloc(1 << power2_size, sizeof(PerftHashTable));
-  hash_size = (1 << power2_size) - 1;
+  return (size_t)Misc::mul_hi64(hash, n_buckets);
 }
 
-template <bool Hash>
-uint64_t PerftBench::perft(depth_t depth)
+// Counters of the perftstats command, gathered over the leaves
+struct PerftBench::PerftStats {
+  uint64_t captures, en_passants, castles, promotions;
+  uint64_t checks, discovery_checks, double_checks, checkmates;
+
+  PerftStats& operator+=(const PerftStats& s)
+  {
+    captures += s.captures; en_passants += s.en_passants;
+    castles += s.castles; promotions += s.promotions;
+    checks += s.checks; discovery_checks += s.discovery_checks;
+    double_checks += s.double_checks; checkmates += s.checkmates;
+    return *this;
+  }
+
+  std::string to_str() const
+  {
+    std::ostringstream out;
+    out << "Captures: " << captures << ", E.P.: " << en_passants
+      << ", Castles: " << castles << ", Promotions: " << promotions
+      << ", Checks: " << checks << ", Discovery Checks: " << discovery_checks
+      << ", Double Checks: " << double_checks << ", Checkmates: " << checkmates;
+    return out.str();
+  }
+};
+
+// Classify the leaf move m. A single check is a discovery check if a piece
+// other than the moved one gives it; the rook of a castling move counts as
+// moved. Double checks are counted apart
+void PerftBench::tally(Position& p, Move::Type m, PerftStats& stats)
+{
+  const Move::Flags Flag = Move::flags(m);
+  if ((Flag == Move::Flags::ENPASSANT) || (p.piece(Move::to_sq(m)) != Piece::NONE))
+    ++stats.captures;
+  if (Flag == Move::Flags::ENPASSANT) ++stats.en_passants;
+  else if (Flag == Move::Flags::CASTLING) ++stats.castles;
+  else if (Flag == Move::Flags::PROMOTION) ++stats.promotions;
+
+  GameLine gl;
+  p.make_move(m, gl);
+  if (p.checkers()) {
+    ++stats.checks;
+    if (Bitboard::more_than_one(p.checkers()))
+      ++stats.double_checks;
+    else if ((Flag != Move::Flags::CASTLING) && (p.checkers() & ~Bitboard::sq_mask(Move::to_sq(m))))
+      ++stats.discovery_checks;
+    if (MoveGen::count(p) == 0)
+      ++stats.checkmates;
+  }
+  p.unmake_move(m, gl);
+}
+
+template <bool Hash, bool Stats>
+uint64_t PerftBench::perft(Position& p, depth_t depth, PerftStats* stats)
 {
   uint64_t nodes = 0;
-  if (Hash) {
-    if (nodes = PerftHash[pos.hash() & hash_size].lookup(pos.hash(), depth))
+  key_t key = 0;
+  if (Hash && !Stats) {
+    key = canonical ? p.canonical_key() : p.hash();
+    if (PerftHash[bucket(key)].lookup(key, depth, nodes))
       return nodes;
   }
-  MoveGen movegen(pos);
+  MoveGen movegen(p);
+  if (Stats && (depth == 1)) {
+    for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++)
+      tally(p, *mlist_ptr, *stats);
+    return movegen.size();
+  }
   GameLine gl;
-  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
-    pos.make_move(*mlist_ptr, gl);
-    nodes += depth <= 2 ? MoveGen(pos).size() : perft<Hash>(depth - 1);
-    pos.unmake_move(*mlist_ptr, gl);
+  if (!Stats && (depth <= 2)) {
+    // Count the leaves in batches
+    LeafBatch batch;
+    for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+      p.make_move(*mlist_ptr, gl);
+      batch.add(p);
+      p.unmake_move(*mlist_ptr, gl);
+    }
+    nodes = batch.flush();
+  }
+  else for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+    p.make_move(*mlist_ptr, gl);
+    nodes += perft<Hash, Stats>(p, depth - 1, stats);
+    p.unmake_move(*mlist_ptr, gl);
   }
-  if (Hash) {
-    PerftHash[pos.hash() & hash_size].store(pos.hash(), depth, nodes);
+  if (Hash && !Stats) {
+    PerftHash[bucket(key)].store(key, depth, nodes);
   }
   return nodes;
 }
 
+// A subtree of the perft tree, counted by a single thread on its own copy
+// of the position
+struct PerftBench::PerftTask {
+  Position pos;
+  size_t root_idx;  // Index of the root move the subtree belongs to
+  uint64_t nodes;
+};
+
+// Collect the positions 'plies' plies below p as perft tasks, each a
+// position of its own made by copy-make
+void PerftBench::split(const Position& p, depth_t plies, size_t root_idx, std::vector<PerftTask>& tasks)
+{
+  if (plies == 0) {
+    tasks.push_back({ p, root_idx, 0 });
+    return;
+  }
+
+  MoveGen movegen(p);
+  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++)
+    split(p.copy_make(*mlist_ptr), plies - 1, root_idx, tasks);
+}
+
+namespace {
+  // Every thread owns a queue of task indices. It takes tasks from the
+  // front of its own queue, and once that's empty, steals from the back
+  // of the queues of other threads
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  bool next_task(std::vector<TaskQueue>& queues, size_t id, size_t& task)
+  {
+    for (size_t i = 0; i < queues.size(); ++i) {
+      TaskQueue& q = queues[(id + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty())
+        continue;
+      if (i == 0) {
+        task = q.tasks.front();
+        q.tasks.pop_front();
+      }
+      else {
+        task = q.tasks.back();
+        q.tasks.pop_back();
+      }
+      return true;
+    }
+    return false;
+  }
+}
+
+// Count the subtrees of all root moves with n_threads threads. The tree is
+// split into tasks split_depth plies below the root (or one ply above the
+// leaves, if that's closer), all threads sharing the perft hash
+void PerftBench::parallel_perft(depth_t depth, MoveGen& movegen, std::vector<uint64_t>& subnodes)
+{
+  const depth_t Plies = std::max<depth_t>(std::min<depth_t>(split_depth, depth - 1), 1);
+  const depth_t Remaining = depth - Plies;
+
+  std::vector<PerftTask> tasks;
+  for (size_t idx = 0; idx < movegen.size(); ++idx)
+    split(pos.copy_make(movegen[idx]), Plies - 1, idx, tasks);
+
+  std::vector<TaskQueue> queues(n_threads);
+  for (size_t t = 0; t < tasks.size(); ++t)
+    queues[t % n_threads].tasks.push_back(t);
+
+  std::vector<std::thread> workers;
+  for (size_t id = 0; id < n_threads; ++id)
+    workers.emplace_back([&, id]() {
+      size_t t;
+      while (next_task(queues, id, t)) {
+        Position& p = tasks[t].pos;
+        tasks[t].nodes = Remaining == 1 ? MoveGen::count(p)
+          : PerftHash == nullptr ? perft<false>(p, Remaining) : perft<true>(p, Remaining);
+      }
+    });
+
+  for (std::thread& worker : workers)
+    worker.join();
+
+  for (const PerftTask& task : tasks)
+    subnodes[task.root_idx] += task.nodes;
+}
+
 uint64_t PerftBench::do_perft(depth_t depth)
 {
   Timer timer;
@@ -58,10 +269,18 @@ uint64_t PerftBench::do_perft(depth_t depth)
   uint64_t nodes = 0;
   MoveGen movegen(pos);
   GameLine gl;
-  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+  if ((n_threads > 1) && (depth > 1)) {
+    std::vector<uint64_t> subnodes(movegen.size(), 0);
+    parallel_perft(depth, movegen, subnodes);
+    for (size_t idx = 0; idx < movegen.size(); ++idx) {
+      nodes += subnodes[idx];
+      os << Move::to_str(movegen[idx]) << ": " << subnodes[idx] << std::endl;
+    }
+  }
+  else for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
     pos.make_move(*mlist_ptr, gl);
-    uint64_t subnodes = depth <= 2 ? MoveGen(pos).size() : PerftHash == nullptr ?
-      perft<false>(depth - 1) : perft<true>(depth - 1);
+    uint64_t subnodes = depth <= 2 ? MoveGen::count(pos) : PerftHash == nullptr ?
+      perft<false>(pos, depth - 1) : perft<true>(pos, depth - 1);
     nodes += subnodes;
     os << Move::to_str(*mlist_ptr) << ": " << subnodes << std::endl;
     if (UpdateCout)
@@ -76,48 +295,621 @@ uint64_t PerftBench::do_perft(depth_t depth)
   return nodes;
 }
 
-void PerftBench::benchmark(depth_t depth)
+// Perft with the counters of PerftStats. With 'divide', the counters are
+// also printed for the subtree of every root move
+uint64_t PerftBench::do_perftstats(depth_t depth, bool divide)
 {
-  size_t idx;
-  for (idx = 0; idx < fen_list.size(); ++idx) {
-    os << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n';
-    os << LongLine << '\n';
+  Timer timer;
+  timer.start();
+  uint64_t nodes = 0;
+  PerftStats total = {};
+  MoveGen movegen(pos);
+  GameLine gl;
+  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+    PerftStats stats = {};
+    uint64_t subnodes = 1;
+    if (depth <= 1)
+      tally(pos, *mlist_ptr, stats);
+    else {
+      pos.make_move(*mlist_ptr, gl);
+      subnodes = perft<false, true>(pos, depth - 1, &stats);
+      pos.unmake_move(*mlist_ptr, gl);
+    }
+    nodes += subnodes;
+    total += stats;
+    os << Move::to_str(*mlist_ptr) << ": " << subnodes;
+    if (divide)
+      os << " (" << stats.to_str() << ")";
+    os << std::endl;
+  }
+  timer.stop();
+  os << "Nodes: " << nodes << '\n' << total.to_str() << '\n';
+  os << "Took " << timer << '\n';
+  return nodes;
+}
+
+namespace {
+  // A position at the split depth of a distributed perft, with the number
+  // of move sequences that lead to it
+  struct SplitPosition {
+    std::string fen;
+    key_t key;
+    uint64_t paths;
+    uint64_t nodes;
+    bool done;
+  };
+
+  // Collect the unique positions 'plies' plies below p. Transpositions are
+  // merged by their Zobrist key
+  void collect(Position& p, depth_t plies, std::unordered_map<key_t, size_t>& index,
+    std::vector<SplitPosition>& positions)
+  {
+    if (plies == 0) {
+      auto it = index.find(p.hash());
+      if (it != index.end())
+        ++positions[it->second].paths;
+      else {
+        index[p.hash()] = positions.size();
+        positions.push_back({ p.to_fen(), p.hash(), 1, 0, false });
+      }
+      return;
+    }
+
+    MoveGen movegen(p);
+    GameLine gl;
+    for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+      p.make_move(*mlist_ptr, gl);
+      collect(p, plies - 1, index, positions);
+      p.unmake_move(*mlist_ptr, gl);
+    }
+  }
+
+  std::string executable_path()
+  {
+#ifdef _WIN32
+    char path[MAX_PATH];
+    DWORD n = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    return std::string(path, n);
+#else
+    char path[4096];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    return n > 0 ? std::string(path, n) : std::string("yaka");
+#endif
+  }
+
+  const size_t WorkerBatchSize = 256;
+}
+
+// Perft split over 'workers' child processes of Yaka. The unique positions
+// at the split depth are sent to the workers in batches (through a batch
+// file on their standard input, the counts coming back through a pipe), and
+// every finished position is appended to the journal. Running the same
+// perft with the same journal again resumes it, skipping the positions the
+// journal already has
+void PerftBench::distributed_perft(depth_t depth, depth_t split, size_t workers,
+  const std::string& journal, size_t hash_mb)
+{
+  if ((split == 0) || (split >= depth)) {
+    os << "Split depth must be between 1 and " << depth - 1 << '\n';
+    return;
+  }
+  Timer timer;
+  timer.start();
+
+  std::unordered_map<key_t, size_t> index;
+  std::vector<SplitPosition> positions;
+  collect(pos, split, index, positions);
+  uint64_t paths = 0;
+  for (const SplitPosition& sp : positions)
+    paths += sp.paths;
+  os << positions.size() << " unique positions at depth " << split
+    << " (" << paths << " paths)" << std::endl;
+
+  // Read the results of earlier runs. Only complete lines of a key and a
+  // count are taken, as a run that crashed may have cut the last one short
+  const std::string Header = "yaka-dperft " + std::to_string(depth) + ' '
+    + std::to_string(split) + ' ' + pos.to_fen();
+  size_t resumed = 0;
+  bool has_header = false;
+  {
+    std::ifstream in(journal, std::ios::binary);
+    std::ostringstream data;
+    data << in.rdbuf();
+    in.close();
+    const std::string Data = data.str();
+
+    size_t begin = 0, end;
+    for (; (end = Data.find('\n', begin)) != std::string::npos; begin = end + 1) {
+      std::string line = Data.substr(begin, end - begin);
+      if (!line.empty() && (line.back() == '\r'))
+        line.pop_back();
+      if (!has_header) {
+        if (line != Header) {
+          os << "Journal " << journal << " belongs to another perft\n";
+          return;
+        }
+        has_header = true;
+        continue;
+      }
+
+      std::istringstream ss(line);
+      key_t key;
+      uint64_t nodes;
+      std::string extra;
+      if (!(ss >> key >> nodes) || (ss >> extra))
+        continue;
+      auto it = index.find(key);
+      if ((it == index.end()) || positions[it->second].done)
+        continue;
+      positions[it->second].nodes = nodes;
+      positions[it->second].done = true;
+      ++resumed;
+    }
+
+    // Drop a line cut short, so that the records appended below start a
+    // line of their own
+    if (begin < Data.size()) {
+      const std::string TmpName = journal + ".tmp";
+      std::ofstream tmp(TmpName, std::ios::binary);
+      tmp.write(Data.data(), begin);
+      tmp.close();
+#ifdef _WIN32
+      // rename() doesn't replace an existing file there
+      if (tmp)
+        std::remove(journal.c_str());
+#endif
+      if (!tmp || (std::rename(TmpName.c_str(), journal.c_str()) != 0)) {
+        std::remove(TmpName.c_str());
+        os << "Could not repair " << journal << '\n';
+        return;
+      }
+    }
+  }
+  if (resumed)
+    os << "Resuming, " << resumed << " positions done" << std::endl;
+
+  std::ofstream out(journal, std::ios::app);
+  if (!out) {
+    os << "Could not open " << journal << '\n';
+    return;
+  }
+  if (!has_header)
+    out << Header << std::endl;
+
+  std::vector<size_t> pending;
+  for (size_t idx = 0; idx < positions.size(); ++idx)
+    if (!positions[idx].done)
+      pending.push_back(idx);
+
+  const std::string Exe = executable_path();
+  size_t next = 0, failed = 0;
+  uint64_t run_nodes = 0;  // Counted by this run, not read from the journal
+  std::mutex mutex;
+  auto work = [&](size_t slot) {
+    const std::string BatchFile = journal + ".batch" + std::to_string(slot);
+    std::string command = '"' + Exe + "\" perftworker " + std::to_string(depth - split)
+      + ' ' + std::to_string(hash_mb) + " < \"" + BatchFile + '"';
+#ifdef _WIN32
+    command = '"' + command + '"';  // cmd.exe strips the outer quotes
+#endif
+    while (true) {
+      std::vector<size_t> batch;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        while ((next < pending.size()) && (batch.size() < WorkerBatchSize))
+          batch.push_back(pending[next++]);
+      }
+      if (batch.empty())
+        break;
+      {
+        std::ofstream bf(BatchFile);
+        for (size_t idx : batch)
+          bf << positions[idx].fen << '\n';
+      }
+
+      // The worker prints one count per line. A line cut short by a crash
+      // is not taken
+      std::vector<uint64_t> results;
+      if (FILE* pipe = popen(command.c_str(), "r")) {
+        char line[64];
+        while ((results.size() < batch.size()) && std::fgets(line, sizeof(line), pipe)
+          && std::strchr(line, '\n'))
+          results.push_back(std::strtoull(line, nullptr, 10));
+        pclose(pipe);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < results.size(); ++i) {
+        SplitPosition& sp = positions[batch[i]];
+        sp.nodes = results[i];
+        sp.done = true;
+        run_nodes += sp.paths * sp.nodes;
+        out << sp.key << ' ' << sp.nodes << '\n';
+      }
+      out.flush();
+      failed += batch.size() - results.size();
+      if (UpdateCout)
+        std::cerr.put('.');
+    }
+    std::remove(BatchFile.c_str());
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t slot = 0; slot < std::max<size_t>(workers, 1); ++slot)
+    threads.emplace_back(work, slot);
+  for (std::thread& t : threads)
+    t.join();
+  timer.stop();
+
+  if (failed) {
+    os << failed << " positions were not counted. Run again to resume\n";
+    return;
+  }
+  uint64_t nodes = 0;
+  for (const SplitPosition& sp : positions)
+    nodes += sp.paths * sp.nodes;
+  unsigned knps = unsigned(run_nodes / timer.get_elapsed_ms());
+  os << "Took " << timer << " for " << nodes << " nodes, " << knps << " KNPS";
+  if (resumed)
+    os << " (over the " << run_nodes << " nodes counted by this run)";
+  os << '\n';
+}
+
+// The worker side of distributed_perft(): count every FEN read from 'is'
+// to 'depth', printing the counts one per line
+void PerftBench::perft_worker(depth_t depth, std::istream& is)
+{
+  std::string fen;
+  while (std::getline(is, fen)) {
+    if (fen.empty()) continue;
+    pos.parse_fen(fen);
+    uint64_t nodes = depth == 0 ? 1 : depth == 1 ? MoveGen::count(pos) :
+      PerftHash == nullptr ? perft<false>(pos, depth) : perft<true>(pos, depth);
+    os << nodes << std::endl;
+  }
+}
+
+// Perft every position of fen_list, n_threads positions at a time. Every
+// thread has its own position and perft hash (of the size of ours, if we
+// have one). The output of a position is written once it and all the ones
+// before it are done, so it comes in the order of the list
+void PerftBench::perft_list(depth_t depth, bool check)
+{
+  struct Result {
+    std::string output, error;
+    uint64_t nodes, ms;
+    bool done;
+  };
+  std::vector<Result> results(fen_list.size());
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t next = 0;
+  const size_t HashMB = PerftHash == nullptr ? 0 : hash_bytes / (1024 * 1024);
+
+  auto work = [&]() {
+    Position p;
+    std::ostringstream out;
+    PerftBench pb(p, out);
+    pb.set_canonical(canonical);
+    if (HashMB)
+      pb.allocate_hash(HashMB);
+    while (true) {
+      size_t idx;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next >= fen_list.size())
+          break;
+        idx = next++;
+      }
+      Result result = { "", "", 0, 0, true };
+      out.str("");
+      out << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n';
+      out << LongLine << '\n';
+      p.parse_fen(fen_list[idx]);
+      Timer timer;
+      timer.start();
+      result.nodes = pb.do_perft(depth);
+      timer.stop();
+      result.ms = timer.get_elapsed_ms();
+
+      if (check) {
+        std::string temp;
+        uint64_t expect;
+        std::stringstream ss(fen_list[idx]);
+        ss >> temp >> temp >> temp >> temp >> temp >> temp >> expect;
+        if (result.nodes != expect) {
+          std::ostringstream error;
+          error << "ERROR: Expected " << expect << " but got " << result.nodes << " nodes.\n";
+          result.error = error.str();
+          out << result.error;
+        }
+      }
+      out << LongLine << "\n\n";
+      result.output = out.str();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      results[idx] = result;
+      finished.notify_all();
+    }
+  };
+
+  Timer timer;
+  timer.start();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < std::min(n_threads, fen_list.size()); ++t)
+    threads.emplace_back(work);
+
+  uint64_t nodes = 0;
+  size_t errors = 0;
+  for (size_t idx = 0; idx < fen_list.size(); ++idx) {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]() { return results[idx].done; });
+    const Result& result = results[idx];
+    nodes += result.nodes;
+    errors += !result.error.empty();
+    os << result.output;
     if (UpdateCout)
-      std::cout << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n' << LongLine << '\n';
-    pos.parse_fen(fen_list[idx]);
-    do_perft(depth);
-    os << LongLine << "\n\n";
+      std::cout << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n' << LongLine << '\n'
+        << "Took " << result.ms << " ms for " << result.nodes << " nodes\n";
+    if (!result.error.empty())
+      std::cout << result.error;
     if (UpdateCout)
       std::cout.put('\n');
   }
+  for (std::thread& t : threads)
+    t.join();
+  timer.stop();
+
+  std::ostringstream summary;
+  summary << fen_list.size() << " positions";
+  if (check)
+    summary << ", " << errors << " errors";
+  summary << ". Took " << timer << " for " << nodes << " nodes, "
+    << unsigned(nodes / timer.get_elapsed_ms()) << " KNPS\n";
+  os << summary.str();
+  if (UpdateCout)
+    std::cout << summary.str();
+}
+
+void PerftBench::benchmark(depth_t depth)
+{
+  perft_list(depth, false);
 }
 
 void PerftBench::verify(depth_t depth)
 {
-  size_t idx;
-  for (idx = 0; idx < fen_list.size(); ++idx) {
-    std::string temp;
-    uint64_t expect, actual;
-    std::stringstream ss(fen_list[idx]);
-    ss >> temp >> temp >> temp >> temp >> temp >> temp >> expect;
-    os << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n';
-    os << LongLine << '\n';
-    if (UpdateCout)
-      std::cout << "Position #" << idx + 1 << ": " << fen_list[idx] << '\n' << LongLine << '\n';
-    pos.parse_fen(fen_list[idx]);
-    actual = do_perft(depth);
+  perft_list(depth, true);
+}
+
+namespace {
+  bool has_ep_capture(const Position& p)
+  {
+    const Color::Type Us = p.side_to_move();
+    if (!(Attacks::PawnAttacks[!Us][p.ep_square()] & p.pawns(Us)))
+      return false;
+    MoveGen movegen(p);
+    for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++)
+      if (Move::flags(*mlist_ptr) == Move::Flags::ENPASSANT)
+        return true;
+    return false;
+  }
 
-    if (actual != expect) {
-      os << "ERROR: Expected " << expect << " but got " << actual << " nodes.\n";
-      std::cout << "ERROR: Expected " << expect << " but got " << actual << " nodes.\n";
+  // Merge the sorted runs in 'files' and the sorted keys 'mem', calling
+  // emit() once for every distinct key, in order. Returns false, after
+  // reporting it, if a run can't be read
+  template <typename Emit>
+  bool merge_runs(const std::vector<std::string>& filenames, const std::vector<uint64_t>& mem,
+    Emit emit, std::ostream& os)
+  {
+    std::vector<std::ifstream> files;
+    for (const std::string& filename : filenames) {
+      files.emplace_back(filename, std::ios::binary);
+      if (!files.back()) {
+        os << "Could not open " << filename << '\n';
+        return false;
+      }
     }
 
-    os << LongLine << "\n\n";
-    if (UpdateCout)
-      std::cout.put('\n');
+    using Head = std::pair<uint64_t, size_t>;  // Key, source
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    size_t mem_idx = 0;
+    // Push the next key of a source. Running out of keys is only fine at
+    // the end of a file, not on an error or in the middle of a key
+    auto advance = [&](size_t src) {
+      uint64_t k;
+      if (src == files.size()) {
+        if (mem_idx < mem.size())
+          heads.push(Head(mem[mem_idx++], src));
+      }
+      else if (files[src].read((char*)&k, sizeof(k)))
+        heads.push(Head(k, src));
+      else if (files[src].bad() || files[src].gcount()) {
+        os << "Could not read " << filenames[src] << '\n';
+        return false;
+      }
+      return true;
+    };
+    for (size_t src = 0; src <= files.size(); ++src)
+      if (!advance(src))
+        return false;
+
+    bool first = true;
+    uint64_t previous = 0;
+    while (!heads.empty()) {
+      Head head = heads.top();
+      heads.pop();
+      if (first || (head.first != previous))
+        emit(head.first);
+      first = false;
+      previous = head.first;
+      if (!advance(head.second))
+        return false;
+    }
+    return true;
+  }
+}
+
+UniquePerft::UniquePerft(Position& pos_, std::ostream& os_, size_t mb, const std::string& prefix)
+  : Benchmarker(pos_, os_), n_keys(0), run_prefix(prefix), nodes(0), spilled_bytes(0),
+  failed(false)
+{
+  size_t size = 1024;
+  while (size * 2 * sizeof(uint64_t) <= mb * 1024 * 1024)
+    size *= 2;
+  keys.assign(size, 0);
+}
+
+// Insert k, returning false if it's already in the set or the set could not
+// be spilled. The set is spilled before it's more than 3/4 full
+bool UniquePerft::insert(uint64_t k)
+{
+  assert(k != 0);
+  const size_t Mask = keys.size() - 1;
+  size_t idx = size_t(k ^ (k >> 32)) & Mask;
+  while (keys[idx] != 0) {
+    if (keys[idx] == k)
+      return false;
+    idx = (idx + 1) & Mask;
+  }
+  if (4 * (n_keys + 1) > 3 * keys.size()) {
+    if (!spill())
+      return false;
+    return insert(k);
+  }
+  keys[idx] = k;
+  ++n_keys;
+  return true;
+}
+
+// Write the set as a sorted run and empty it. On failure the set is kept,
+// and 'failed' is set to stop the perft
+bool UniquePerft::spill()
+{
+  std::vector<uint64_t> run;
+  run.reserve(n_keys);
+  for (uint64_t k : keys)
+    if (k) run.push_back(k);
+  std::sort(run.begin(), run.end());
+
+  const std::string Filename = run_prefix + ".run" + std::to_string(runs.size());
+  std::ofstream out(Filename, std::ios::binary);
+  runs.push_back(Filename);
+  if (out)
+    out.write((const char*)run.data(), run.size() * sizeof(uint64_t));
+  out.close();
+  if (!out) {
+    os << "Could not write " << Filename << '\n';
+    failed = true;
+    return false;
+  }
+  spilled_bytes += run.size() * sizeof(uint64_t);
+
+  std::fill(keys.begin(), keys.end(), 0);
+  n_keys = 0;
+  return true;
+}
+
+// Visit the positions below pos. A position already in the set at the same
+// depth has had its subtree visited, so it's not searched again. Keys
+// spilled to disk are forgotten, and their subtrees are visited again; the
+// duplicates this adds are removed by the merge
+void UniquePerft::visit(depth_t ply, depth_t depth)
+{
+  MoveGen movegen(pos);
+  GameLine gl;
+  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+    pos.make_move(*mlist_ptr, gl);
+    ++nodes;
+    // The en passant square is set after every double push, but only makes
+    // a different position if a pawn can legally capture there
+    key_t hash = pos.hash();
+    const Square::Type Ep = pos.ep_square();
+    if ((Ep != Square::NONE) && !has_ep_capture(pos))
+      hash ^= Zobrist::EpHash[Ep];
+    const uint64_t Key = (hash & ((1ULL << DepthShift) - 1)) | (uint64_t(ply + 1) << DepthShift);
+    if (insert(Key) && (ply + 1 < depth))
+      visit(ply + 1, depth);
+    pos.unmake_move(*mlist_ptr, gl);
+    if (failed)
+      return;
   }
 }
 
+void UniquePerft::run(depth_t depth)
+{
+  if ((depth == 0) || (depth > MaxDepth)) {
+    os << "Depth must be between 1 and " << MaxDepth << '\n';
+    return;
+  }
+  Timer timer;
+  timer.start();
+  visit(0, depth);
+  const size_t SetBytes = keys.size() * sizeof(uint64_t);
+  const size_t Spilled = runs.size();
+  // Every file written, removed once done with
+  std::vector<std::string> files = runs;
+  auto remove_files = [&]() {
+    for (const std::string& file : files)
+      std::remove(file.c_str());
+  };
+  if (failed) {
+    remove_files();
+    return;
+  }
+
+  // Merge the runs in passes of at most MergeWays runs into longer ones,
+  // keeping every distinct key once, until they can all be merged at once
+  while (runs.size() > MergeWays) {
+    std::vector<std::string> merged;
+    for (size_t i = 0; i < runs.size(); i += MergeWays) {
+      const std::vector<std::string> Group(runs.begin() + i,
+        runs.begin() + std::min(i + MergeWays, runs.size()));
+      const std::string Filename = run_prefix + ".merge" + std::to_string(files.size());
+      files.push_back(Filename);
+      merged.push_back(Filename);
+
+      std::ofstream out(Filename, std::ios::binary);
+      bool ok = bool(out) && merge_runs(Group, std::vector<uint64_t>(), [&](uint64_t k) {
+        out.write((const char*)&k, sizeof(k));
+      }, os);
+      out.close();
+      if (ok && !out)
+        os << "Could not write " << Filename << '\n';
+      if (!ok || !out) {
+        remove_files();
+        return;
+      }
+      for (const std::string& run : Group)
+        std::remove(run.c_str());
+    }
+    runs = merged;
+  }
+
+  // Merge the runs and the keys still in memory, counting every distinct
+  // key once
+  std::vector<uint64_t> last;
+  last.reserve(n_keys);
+  for (uint64_t k : keys)
+    if (k) last.push_back(k);
+  std::sort(last.begin(), last.end());
+  keys = std::vector<uint64_t>();
+
+  std::vector<uint64_t> unique(depth + 1, 0);
+  const bool Merged = merge_runs(runs, last, [&](uint64_t k) {
+    ++unique[k >> DepthShift];
+  }, os);
+  remove_files();
+  if (!Merged)
+    return;
+  timer.stop();
+
+  for (depth_t d = 1; d <= depth; ++d)
+    os << "Depth " << d << ": " << unique[d] << " unique positions\n";
+  os << "Took " << timer << " for " << nodes << " nodes, "
+    << unsigned(nodes / timer.get_elapsed_ms()) << " KNPS\n";
+  os << "Key set: " << SetBytes / (1024 * 1024) << " MB, " << Spilled << " runs spilled (" << spilled_bytes / (1024 * 1024) << " MB)\n";
+}
+
 template <bool Debug>
 void EvalDebugger::eval()
 {
@@ -161,6 +953,222 @@ uint64_t EvalDebugger::test_eval(depth_t depth)
   return nodes;
 }
 
+SliderBench::SliderBench(Position& pos_, std::ostream& os_)
+  : Benchmarker(pos_, os_), n_positions(0)
+{
+  fen_list = {
+    "r3k2r/1b1q1ppp/p1n1pn2/1pbp4/3P1B2/P1NBPN2/1PQ2PPP/R3K2R w KQkq - 0 1",
+    "2rr2k1/1b2qppp/pn2p3/1pbp4/3P4/1PNBPN2/PBQ2PPP/2RR2K1 w - - 0 1",
+    "r1b2rk1/2q1bppp/p2ppn2/1p6/3BPP2/2NB1Q2/PPP3PP/R4R1K w - - 0 1",
+    "1r2r1k1/3bqpbp/p2p1np1/1pp5/4P3/1PNB1N1P/PBQ2PP1/R3R1K1 w - - 0 1",
+    "3r1rk1/1bq2pbp/p5p1/1p6/8/1P3NP1/PB2QPBP/3RR1K1 w - - 0 1",
+    "r4rk1/1b3ppp/p3q3/1pb5/8/1P1B1Q2/PB3PPP/R4RK1 w - - 0 1",
+    "2b1r1k1/5ppp/1q6/8/2B5/1Q6/5PPP/2B1R1K1 w - - 0 1",
+    "4r1k1/1b3q2/8/8/8/8/1B3Q2/4R1K1 w - - 0 1"
+  };
+
+  GameLine gl;
+  for (const std::string& fen : fen_list) {
+    pos.parse_fen(fen);
+    add_lookups(pos);
+    MoveGen movegen(pos);
+    for (size_t i = 0; i < movegen.size(); ++i) {
+      pos.make_move(movegen[i], gl);
+      add_lookups(pos);
+      pos.unmake_move(movegen[i], gl);
+    }
+  }
+}
+
+// The lookups for the attacks of all sliders of 'p', queens looking up both
+void SliderBench::add_lookups(const Position& p)
+{
+  using namespace Piece;
+  const uint64_t Occupied = p.all_pieces();
+  uint64_t b = p.pieces(WHITE_ROOK, BLACK_ROOK, WHITE_QUEEN, BLACK_QUEEN);
+  while (b)
+    rook_lookups.push_back(std::make_pair(Bitboard::pop_1st_bit(&b), Occupied));
+  b = p.pieces(WHITE_BISHOP, BLACK_BISHOP, WHITE_QUEEN, BLACK_QUEEN);
+  while (b)
+    bishop_lookups.push_back(std::make_pair(Bitboard::pop_1st_bit(&b), Occupied));
+  ++n_positions;
+}
+
+template <bool Pext>
+uint64_t SliderBench::lookup_all(size_t rounds)
+{
+  // Summing the attacks keeps the lookups from being optimized away
+  uint64_t sum = 0;
+  for (size_t r = 0; r < rounds; ++r) {
+    for (const auto& l : rook_lookups)
+#ifdef USE_PEXT
+      sum += Pext ? Attacks::pext_attacks<Piece::ROOK>(l.first, l.second)
+        : Attacks::slider_attacks<Piece::ROOK>(l.first, l.second);
+#else
+      sum += Attacks::slider_attacks<Piece::ROOK>(l.first, l.second);
+#endif
+    for (const auto& l : bishop_lookups)
+#ifdef USE_PEXT
+      sum += Pext ? Attacks::pext_attacks<Piece::BISHOP>(l.first, l.second)
+        : Attacks::slider_attacks<Piece::BISHOP>(l.first, l.second);
+#else
+      sum += Attacks::slider_attacks<Piece::BISHOP>(l.first, l.second);
+#endif
+  }
+  return sum;
+}
+
+void SliderBench::run(size_t million_lookups)
+{
+  const uint64_t PerRound = rook_lookups.size() + bishop_lookups.size();
+  const size_t Rounds = std::max<size_t>(1, size_t(million_lookups * 1000000 / PerRound));
+  const uint64_t Lookups = PerRound * Rounds;
+  os << rook_lookups.size() << " rook and " << bishop_lookups.size()
+     << " bishop lookups from " << n_positions << " positions, repeated "
+     << Rounds << " times\n";
+
+  Timer timer;
+  timer.start();
+  const uint64_t MagicSum = lookup_all<false>(Rounds);
+  timer.stop();
+  os << "Magics: Took " << timer << " for " << Lookups << " lookups, "
+     << Lookups / timer.get_elapsed_ms() << " lookups/ms\n";
+
+#ifdef USE_PEXT
+  timer.start();
+  const uint64_t PextSum = lookup_all<true>(Rounds);
+  timer.stop();
+  os << "Pext:   Took " << timer << " for " << Lookups << " lookups, "
+     << Lookups / timer.get_elapsed_ms() << " lookups/ms\n";
+  if (PextSum != MagicSum)
+    os << "Error: the backends don't give the same attacks\n";
+#else
+  (void)MagicSum;
+  os << "Pext: not built in (needs a BMI2 build, without NO_PEXT)\n";
+#endif
+}
+
+MakeMoveBench::MakeMoveBench(Position& pos_, std::ostream& os_)
+  : Benchmarker(pos_, os_), n_moves(0)
+{
+  fen_list = {
+    Program::StartFen,
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"
+  };
+  for (const std::string& fen : fen_list) {
+    pos.parse_fen(fen);
+    collect(pos, 2);
+  }
+}
+
+// Keep p and its legal moves, and the positions 'plies' moves away from it
+void MakeMoveBench::collect(Position& p, depth_t plies)
+{
+  MoveGen movegen(p);
+  positions.push_back(p);
+  move_lists.emplace_back(movegen.begin(), movegen.begin() + movegen.size());
+  n_moves += movegen.size();
+  if (plies == 0)
+    return;
+
+  GameLine gl;
+  for (size_t i = 0; i < movegen.size(); ++i) {
+    p.make_move(movegen[i], gl);
+    collect(p, plies - 1);
+    p.unmake_move(movegen[i], gl);
+  }
+}
+
+template <bool Generate>
+uint64_t MakeMoveBench::make_all(size_t rounds)
+{
+  // Summing the keys keeps the moves from being optimized away
+  uint64_t sum = 0;
+  GameLine gl;
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < positions.size(); ++i) {
+      Position& p = positions[i];
+      for (const Move::Type M : move_lists[i]) {
+        p.make_move(M, gl);
+        sum += p.hash() + p.checkers();
+        if (Generate)
+          sum += MoveGen::count(p);
+        p.unmake_move(M, gl);
+      }
+    }
+  }
+  return sum;
+}
+
+// Perft of p by make/unmake, with the moves of the last ply counted
+uint64_t MakeMoveBench::perft_unmake(Position& p, depth_t depth)
+{
+  if (depth == 1)
+    return MoveGen::count(p);
+  uint64_t nodes = 0;
+  MoveGen movegen(p);
+  GameLine gl;
+  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
+    p.make_move(*mlist_ptr, gl);
+    nodes += perft_unmake(p, depth - 1);
+    p.unmake_move(*mlist_ptr, gl);
+  }
+  return nodes;
+}
+
+// The same perft by copy-make
+uint64_t MakeMoveBench::perft_copy(const Position& p, depth_t depth)
+{
+  if (depth == 1)
+    return MoveGen::count(p);
+  uint64_t nodes = 0;
+  MoveGen movegen(p);
+  for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++)
+    nodes += perft_copy(p.copy_make(*mlist_ptr), depth - 1);
+  return nodes;
+}
+
+void MakeMoveBench::run(size_t million_moves, depth_t depth)
+{
+  const size_t Rounds = std::max<size_t>(1, size_t(million_moves * 1000000 / n_moves));
+  const uint64_t Moves = uint64_t(n_moves) * Rounds;
+  os << n_moves << " moves from " << positions.size() << " positions, repeated "
+     << Rounds << " times\n";
+
+  Timer timer;
+  timer.start();
+  uint64_t sum = make_all<false>(Rounds);
+  timer.stop();
+  os << "Make/unmake:         Took " << timer << " for " << Moves << " moves, "
+     << Moves / timer.get_elapsed_ms() << " moves/ms\n";
+
+  timer.start();
+  sum += make_all<true>(Rounds);
+  timer.stop();
+  os << "Make/movegen/unmake: Took " << timer << " for " << Moves << " moves, "
+     << Moves / timer.get_elapsed_ms() << " moves/ms\n";
+  os << "Checksum: " << sum << '\n';
+
+  // Perft of all positions, without hash or batches, both ways
+  uint64_t nodes[2] = { 0, 0 };
+  for (int copy = 0; copy < 2; ++copy) {
+    timer.start();
+    for (const std::string& fen : fen_list) {
+      pos.parse_fen(fen);
+      nodes[copy] += copy ? perft_copy(pos, depth) : perft_unmake(pos, depth);
+    }
+    timer.stop();
+    os << "Perft " << depth << (copy ? " by copy-make:   " : " by make/unmake: ")
+       << "Took " << timer << " for " << nodes[copy] << " nodes, "
+       << nodes[copy] / timer.get_elapsed_ms() << " nodes/ms\n";
+  }
+  if (nodes[0] != nodes[1])
+    os << "Error: the perft counts differ\n";
+}
+
 void EvalDebugger::benchmark(depth_t depth, bool debug)
 {
   size_t idx;
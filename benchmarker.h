@@ -7,6 +7,7 @@
 #include <iostream>
 
 class Position;
+class MoveGen;
 class Benchmarker {
 protected:
   std::vector<std::string> fen_list;
@@ -20,43 +21,174 @@ public:
 };
 
 class PerftBench : public Benchmarker {
-  struct PerftHashTable {
+  // The table is shared by all perft threads without locks. The full key
+  // is stored XORed with the data, so an entry torn by two threads writing
+  // it at once doesn't match. The low 8 bits of the data hold the depth,
+  // the rest the node count
+  struct PerftEntry {
     key_t hash_key;
     uint64_t data;
+  };
+
+  // Four entries, filling a cache line. A new entry replaces the one of the
+  // same position, or else the one with the smallest depth (and the fewest
+  // nodes among those), as it saves the least work
+  struct PerftBucket {
+    static const int Ways = 4;
+    PerftEntry entry[Ways];
 
     void store(key_t hash, depth_t d, uint64_t nodes)
     {
-      if (nodes < (data >> 6)) return;
-      hash_key = hash;
-      assert(nodes < (1ULL << 58));
-      data = (nodes << 6) | d;
+      assert((d < 256) && (nodes < (1ULL << 56)));
+      const uint64_t Data = (nodes << 8) | d;
+      PerftEntry* replace = &entry[0];
+      for (int i = 0; i < Ways; ++i) {
+        const uint64_t Old = entry[i].data;
+        if ((entry[i].hash_key ^ Old) == hash) {
+          if ((Old & 0xFF) > d) return;  // Keep the deeper count
+          replace = &entry[i];
+          break;
+        }
+        if (((Old & 0xFF) < (replace->data & 0xFF))
+          || (((Old & 0xFF) == (replace->data & 0xFF)) && (Old < replace->data)))
+          replace = &entry[i];
+      }
+      replace->data = Data;
+      replace->hash_key = hash ^ Data;
     }
 
-    uint64_t lookup(key_t hash, depth_t d)
+    bool lookup(key_t hash, depth_t d, uint64_t& nodes) const
     {
-      if ((hash == hash_key) && ((data & 63) == d))
-        return data >> 6;
-      else return 0;
+      for (int i = 0; i < Ways; ++i) {
+        const uint64_t Data = entry[i].data;
+        if (((entry[i].hash_key ^ Data) == hash) && ((Data & 0xFF) == d)) {
+          nodes = Data >> 8;
+          return true;
+        }
+      }
+      return false;
     }
   } *PerftHash;
-  size_t hash_size;
+  static_assert(sizeof(PerftBucket) == 64, "Perft buckets must fill a cache line");
+  size_t n_buckets;
+  size_t hash_bytes;
+
+  inline size_t bucket(key_t hash) const;
+  void release_hash();
+  size_t n_threads;
+  depth_t split_depth;
+  bool canonical;  // Hash positions by Position::canonical_key()
   const bool UpdateCout;
+
+  struct PerftTask;
+  struct PerftStats;
+  static void tally(Position& p, Move::Type m, PerftStats& stats);
+  void split(const Position& p, depth_t plies, size_t root_idx, std::vector<PerftTask>& tasks);
+  void parallel_perft(depth_t depth, MoveGen& movegen, std::vector<uint64_t>& subnodes);
+  void perft_list(depth_t depth, bool check);
 public:
   PerftBench() = delete;
   PerftBench(Position& pos_, std::ostream& os_)
-    : Benchmarker(pos_, os_), UpdateCout(false) { PerftHash = nullptr; }
+    : Benchmarker(pos_, os_), canonical(false), UpdateCout(false) { PerftHash = nullptr; set_threads(1); }
   PerftBench(Position& pos_, std::ostream& os_, std::istream& is)
-    : Benchmarker(pos_, os_, is), UpdateCout(false) { PerftHash = nullptr; }
+    : Benchmarker(pos_, os_, is), canonical(false), UpdateCout(false) { PerftHash = nullptr; set_threads(1); }
   PerftBench(Position& pos_, std::ostream& os_, std::istream& is, bool update)
-    : Benchmarker(pos_, os_, is), UpdateCout(update) { PerftHash = nullptr; }
+    : Benchmarker(pos_, os_, is), canonical(false), UpdateCout(update) { PerftHash = nullptr; set_threads(1); }
   ~PerftBench();
 
-  template <bool Hash>
-  uint64_t perft(depth_t depth);
+  static const depth_t DefaultSplitDepth = 3;
+
+  // With 'Stats' set, every leaf is classified into the counters of 'stats'
+  // (and the hash is not used). Otherwise 'stats' is never touched and the
+  // leaves are bulk counted
+  template <bool Hash, bool Stats = false>
+  uint64_t perft(Position& p, depth_t depth, PerftStats* stats = nullptr);
   uint64_t do_perft(depth_t depth);
+  uint64_t do_perftstats(depth_t depth, bool divide);
+  void distributed_perft(depth_t depth, depth_t split, size_t workers,
+    const std::string& journal, size_t hash_mb);
+  void perft_worker(depth_t depth, std::istream& is);
+  void set_threads(size_t threads, depth_t split = DefaultSplitDepth)
+  {
+    n_threads = threads ? threads : 1;
+    split_depth = split ? split : 1;
+  }
+  void set_canonical(bool c) { canonical = c; }
   void benchmark(depth_t depth);
   void verify(depth_t depth);
-  void allocate_hash(int power2_size);
+  bool allocate_hash(size_t mb);
+};
+
+// Counts the distinct positions at every depth, telling positions apart by
+// their Zobrist keys. The keys are kept in an in-memory set, which is
+// written to disk as a sorted run whenever it fills up. The runs are merged
+// at the end
+class UniquePerft : public Benchmarker {
+  // The depth of a key is kept in its top bits, so the same position at
+  // two depths counts at both
+  static const int DepthShift = 60;
+  static const depth_t MaxDepth = 15;
+  // Most runs merged at once, i.e. files the merge keeps open, well below
+  // the usual limits on open files
+  static const size_t MergeWays = 32;
+
+  std::vector<uint64_t> keys;  // Open addressing, 0 marks an empty slot
+  size_t n_keys;
+  std::string run_prefix;
+  std::vector<std::string> runs;
+  uint64_t nodes, spilled_bytes;
+  bool failed;  // A run could not be written
+
+  bool insert(uint64_t k);
+  bool spill();
+  void visit(depth_t ply, depth_t depth);
+public:
+  UniquePerft() = delete;
+  UniquePerft(Position& pos_, std::ostream& os_, size_t mb, const std::string& prefix);
+  ~UniquePerft() {}
+
+  void run(depth_t depth);
+};
+
+// Times the slider attack backends against each other: the lookups for the
+// sliders of a few positions full of sliders, and of the positions a move
+// away from them, are repeated with the magics and (on builds with
+// USE_PEXT) with pext
+class SliderBench : public Benchmarker {
+  typedef std::vector<std::pair<Square::Type, uint64_t>> LookupList;
+  LookupList rook_lookups, bishop_lookups;
+  size_t n_positions;
+
+  void add_lookups(const Position& p);
+  template <bool Pext> uint64_t lookup_all(size_t rounds);
+public:
+  SliderBench() = delete;
+  SliderBench(Position& pos_, std::ostream& os_);
+  ~SliderBench() {}
+
+  void run(size_t million_lookups);
+};
+
+// Times make_move and unmake_move: every legal move of the perft positions
+// and of the positions up to two moves away from them is made and unmade,
+// once with nothing in between and once with the moves of the new
+// position counted by MoveGen. Then the perft positions are perft'd by
+// make/unmake and by copy-make
+class MakeMoveBench : public Benchmarker {
+  std::vector<Position> positions;
+  std::vector<std::vector<Move::Type>> move_lists;
+  size_t n_moves;
+
+  void collect(Position& p, depth_t plies);
+  template <bool Generate> uint64_t make_all(size_t rounds);
+  uint64_t perft_unmake(Position& p, depth_t depth);
+  uint64_t perft_copy(const Position& p, depth_t depth);
+public:
+  MakeMoveBench() = delete;
+  MakeMoveBench(Position& pos_, std::ostream& os_);
+  ~MakeMoveBench() {}
+
+  void run(size_t million_moves, depth_t depth);
 };
 
 class EvalDebugger : public Benchmarker {
@@ -2,25 +2,6 @@
 #include <sstream>
 
 namespace Bitboard {
-  uint64_t SquareMask[Square::SQ_NB]; // 1ULL << sq
-  uint64_t ThisAndNextSq[Square::SQ_NB];  // 3ULL << sq
-  uint64_t PrevSquares[Square::SQ_NB];
-#ifndef USE_INTRIN
-  Square::Type BitScanTable[64];
-#endif
-
-  void init()
-  {
-    for (Square::Type sq = Square::A1; sq < Square::SQ_NB; ++sq) {
-      SquareMask[sq] = 1ULL << sq;
-      ThisAndNextSq[sq] = 3ULL << sq;
-      PrevSquares[sq] = (sq_mask(sq) - 1) + (sq == 0);
-#ifndef USE_INTRIN
-      BitScanTable[((SquareMask[sq] | PrevSquares[sq]) * DeBruijn64) >> 58] = sq;
-#endif
-    }
-  }
-
   std::string to_str(uint64_t b)
   {
     std::ostringstream ss;
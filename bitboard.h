@@ -9,9 +9,6 @@ namespace Bitboard {
   const uint64_t Universe = 0xFFFFFFFFFFFFFFFFULL;
   const uint64_t LightSquares = ~0xAA55AA55AA55AA55ULL;
   const uint64_t DarkSquares = 0xAA55AA55AA55AA55ULL;
-  extern uint64_t SquareMask[Square::SQ_NB];
-  extern uint64_t ThisAndNextSq[Square::SQ_NB];
-  extern uint64_t PrevSquares[Square::SQ_NB];
   // File Masks
   const uint64_t FileAMask = 0x0101010101010101ULL;
   const uint64_t FileBMask = 0x0202020202020202ULL;
@@ -62,6 +59,34 @@ namespace Bitboard {
     0x0204081020408000ULL
   };
 
+  const uint64_t DeBruijn64 = 0x03F79D71B4CB0A89ULL;
+
+  // The square tables, generated at compile time
+  struct SquareTables {
+    uint64_t square_mask[Square::SQ_NB]; // 1ULL << sq
+    uint64_t this_and_next_sq[Square::SQ_NB];  // 3ULL << sq
+    uint64_t prev_squares[Square::SQ_NB];
+    Square::Type bitscan[64];
+  };
+
+  constexpr SquareTables make_square_tables()
+  {
+    SquareTables t = {};
+    for (int sq = 0; sq < Square::SQ_NB; ++sq) {
+      t.square_mask[sq] = 1ULL << sq;
+      t.this_and_next_sq[sq] = 3ULL << sq;
+      t.prev_squares[sq] = ((1ULL << sq) - 1) + (sq == 0);
+      t.bitscan[((t.square_mask[sq] | t.prev_squares[sq]) * DeBruijn64) >> 58] = Square::Type(sq);
+    }
+    return t;
+  }
+
+  constexpr SquareTables SqTables = make_square_tables();
+  static constexpr const uint64_t (&SquareMask)[Square::SQ_NB] = SqTables.square_mask;
+  static constexpr const uint64_t (&ThisAndNextSq)[Square::SQ_NB] = SqTables.this_and_next_sq;
+  static constexpr const uint64_t (&PrevSquares)[Square::SQ_NB] = SqTables.prev_squares;
+  static constexpr const Square::Type (&BitScanTable)[64] = SqTables.bitscan;
+
   inline uint64_t sq_mask(Square::Type sq)
   {
     return SquareMask[sq];
@@ -72,10 +97,6 @@ namespace Bitboard {
     return sq_mask(sq) | sq_mask(rest...);
   }
 
-#ifndef USE_INTRIN
-  const uint64_t DeBruijn64 = 0x03F79D71B4CB0A89ULL;
-  extern Square::Type BitScanTable[64];
-#endif
 
   inline Square::Type lsb(uint64_t b)
   {
@@ -83,6 +104,8 @@ namespace Bitboard {
     unsigned long idx;
     _BitScanForward64(&idx, b);
     return (Square::Type) idx;
+#elif defined(USE_BUILTINS)
+    return Square::Type(__builtin_ctzll(b));
 #else
     return BitScanTable[((b ^ (b - 1)) * DeBruijn64) >> 58];
 #endif
@@ -97,6 +120,8 @@ namespace Bitboard {
     unsigned long idx;
     _BitScanReverse64(&idx, b);
     return (Square::Type) idx;
+#elif defined(USE_BUILTINS)
+    return Square::Type(63 ^ __builtin_clzll(b));
 #else
     b |= (b |= (b |= (b |= (b |= b >> 1) >> 2) >> 4) >> 8) >> 16;
     return BitScanTable[((b | b >> 32) * DeBruijn64) >> 58];
@@ -107,6 +132,9 @@ namespace Bitboard {
   {
 #ifdef USE_INTRIN
     return (count_t)__popcnt64(b);
+#elif defined(USE_BUILTINS) && defined(__POPCNT__)
+    // Without POPCNT the builtin is a library call, slower than the SWAR
+    return (count_t)__builtin_popcountll(b);
 #else
     b -= (b >> 1) & 0x5555555555555555ULL;
     b = ((b >> 2) & 0x3333333333333333ULL) + (b & 0x3333333333333333ULL);
@@ -116,7 +144,7 @@ namespace Bitboard {
 
   inline count_t sparse_bit_count(uint64_t b)
   {
-#ifdef USE_INTRIN
+#if defined(USE_INTRIN) || (defined(USE_BUILTINS) && defined(__POPCNT__))
     return bit_count(b);
 #else
 #define HANDLE(x) if (b == 0) return x; b &= b - 1;
@@ -148,6 +176,8 @@ namespace Bitboard {
   {
 #ifdef USE_INTRIN
     return _byteswap_uint64(b);
+#elif defined(USE_BUILTINS)
+    return __builtin_bswap64(b);
 #else
     b = ((b >> 8) & 0x00FF00FF00FF00FFULL) | ((b & 0x00FF00FF00FF00FFULL) << 8);
     b = ((b >> 16) & 0x0000FFFF0000FFFFULL) | ((b & 0x0000FFFF0000FFFFULL) << 16);
@@ -211,7 +241,6 @@ namespace Bitboard {
 
   inline bool more_than_one(uint64_t b) { return (b & (b - 1)) != 0; }
   inline bool bit_set(uint64_t b, Square::Type sq) { return (b & sq_mask(sq)) != 0; }
-  void init();
   std::string to_str(uint64_t b);
 }
 
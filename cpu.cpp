@@ -0,0 +1,45 @@
+#include "cpu.h"
+#include <cstdlib>
+
+namespace CPU {
+  Level Current = GENERIC;
+
+  namespace {
+    Level detect()
+    {
+#ifdef USE_CPU_DISPATCH
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")
+          && __builtin_cpu_supports("popcnt"))
+        return AVX2;
+      if (__builtin_cpu_supports("popcnt"))
+        return POPCNT;
+#elif defined(__AVX2__) && defined(__BMI2__)
+      // Built for these, so the CPU has them
+      return AVX2;
+#endif
+      return GENERIC;
+    }
+  }
+
+  void init()
+  {
+    Current = detect();
+    const char* Forced = std::getenv("YAKA_CPU");
+    if (!Forced)
+      return;
+    for (Level level = GENERIC; level < Current; level = Level(level + 1))
+      if (to_str(level) == Forced)
+        Current = level;
+  }
+
+  std::string to_str(Level level)
+  {
+    switch (level) {
+    case GENERIC: return "generic";
+    case POPCNT: return "popcnt";
+    case AVX2: return "avx2";
+    default: return "";
+    }
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef INC_CPU_H_
+#define INC_CPU_H_
+#include "yaka.h"
+
+// The instruction sets the hot kernels are compiled for. With
+// USE_CPU_DISPATCH, every kernel is compiled once per level and the one of
+// the best level the CPU supports is used; other builds only have the
+// kernels of the flags they were compiled with. The level also picks the
+// slider attacks of pext builds (see pext.h)
+namespace CPU {
+  enum Level {
+    GENERIC,  // x86-64 baseline: SWAR popcount, no SIMD beyond SSE2
+    POPCNT,   // Nehalem and later
+    AVX2,     // AVX2 and BMI2: Haswell, Zen and later
+    LEVEL_NB
+  };
+
+  extern Level Current;
+
+  // Detect the level of this CPU. The environment variable YAKA_CPU
+  // (generic, popcnt or avx2) can lower it, to compare the kernels
+  void init();
+  std::string to_str(Level level);
+}
+
+// Put the functions defined between BEGIN_TARGET(t) and END_TARGET() in
+// target t, as __attribute__((target(t))) would, so that the same code can
+// be compiled for several instruction sets in one translation unit
+#ifdef USE_CPU_DISPATCH
+#define YAKA_PRAGMA(x) _Pragma(#x)
+#ifdef __clang__
+#define BEGIN_TARGET(t) \
+  YAKA_PRAGMA(clang attribute push(__attribute__((target(t))), apply_to = function))
+#define END_TARGET() YAKA_PRAGMA(clang attribute pop)
+#else
+#define BEGIN_TARGET(t) YAKA_PRAGMA(GCC push_options) YAKA_PRAGMA(GCC target(t))
+#define END_TARGET() YAKA_PRAGMA(GCC pop_options)
+#endif
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+#include "evalcache.h"
+#include <cstring>
+
+EvalCache::EvalCache()
+{
+  entry = nullptr;
+  resize(DefaultLog2Size);
+}
+
+EvalCache::~EvalCache()
+{
+  delete[] entry;
+}
+
+void EvalCache::clear()
+{
+  std::memset(entry, 0, sizeof(uint64_t) * (mask + 1));
+}
+
+void EvalCache::resize(size_t log2size)
+{
+  delete[] entry;
+  mask = (1ULL << log2size) - 1;
+  entry = new uint64_t[mask + 1];
+  clear();
+}
@@ -0,0 +1,40 @@
+#ifndef INC_EVALCACHE_H_
+#define INC_EVALCACHE_H_
+#include "yaka.h"
+
+// A small direct-mapped cache of static evaluations. Each entry is a single
+// 64-bit word, so an entry is always read and written as a whole and the
+// cache can be shared without locks:
+// <upper 32 bits of the hash> = entry >> 32
+// <evaluation>                = int32_t(entry & 0xFFFFFFFF)
+class EvalCache
+{
+  uint64_t* entry;
+  size_t mask;  // index of a position in cache = <hash> & mask
+public:
+  static const size_t DefaultLog2Size = 16; // 512 kB
+
+  EvalCache();
+  ~EvalCache();
+  void clear();
+  void resize(size_t log2size);
+  inline bool probe(key_t hash, int& eval) const;
+  inline void store(key_t hash, int eval);
+};
+
+inline bool EvalCache::probe(key_t hash, int& eval) const
+{
+  const uint64_t e = entry[hash & mask];
+  if ((e >> 32) != (hash >> 32))
+    return false;
+
+  eval = int32_t(uint32_t(e));
+  return true;
+}
+
+inline void EvalCache::store(key_t hash, int eval)
+{
+  entry[hash & mask] = (hash & 0xFFFFFFFF00000000ULL) | uint32_t(eval);
+}
+
+#endif
@@ -325,7 +325,7 @@ std::string Evaluator::to_str()
   ss << std::endl;
 
   ss << "Non Pawn Material: " << PRINT(non_pawn_material) << std::endl;
-  ss << "Final Eval: " << PRINT(interpolate_score(s, pos->side_to_move())) << std::endl;
+  ss << "Final Eval: " << PRINT(interpolate_score(s, pos->side_to_move()) * Score::EVAL_GRAIN) << std::endl;
   return ss.str();
 }
 
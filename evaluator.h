@@ -2,6 +2,7 @@
 #define INC_EVALUATOR_H_
 
 #include "score.h"
+#include <algorithm>
 
 class Position;
 /// <summary>
@@ -66,16 +67,23 @@ inline double Evaluator::to_cp(int s)
   return s / 1000.;
 }
 
+// Returns the tapered score, converted from millipawns to the search scale
 inline int Evaluator::interpolate_score(const Score& s, int stm)
 {
   stm = (-2 * stm) + 1; // 1 for White, -1 for black
-  if (non_pawn_material > Score::MG_BOUND) return stm * s.mg;
-  if (non_pawn_material < Score::EG_BOUND) return stm * s.eg;
-  int sc = ((non_pawn_material - Score::EG_BOUND) * 128) / Score::INTERPOL;
-  sc = (s.mg * sc) + (s.eg * (128 - sc));
-  sc /= 128;
-  sc *= stm;
-  return sc;
+  int sc;
+  if (non_pawn_material > Score::MG_BOUND) sc = s.mg;
+  else if (non_pawn_material < Score::EG_BOUND) sc = s.eg;
+  else {
+    sc = ((non_pawn_material - Score::EG_BOUND) * 128) / Score::INTERPOL;
+    sc = (s.mg * sc) + (s.eg * (128 - sc));
+    sc /= 128;
+  }
+  sc /= Score::EVAL_GRAIN;
+
+  // Never let an evaluation pass for a mate score
+  sc = std::max(std::min(sc, Score::MATE_BOUND - 1), -Score::MATE_BOUND + 1);
+  return stm * sc;
 }
 
 #endif
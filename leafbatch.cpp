@@ -0,0 +1,111 @@
+#include "leafbatch.h"
+#include "position.h"
+#include "movegen.h"
+#include "cpu.h"
+#if defined(__AVX2__) || defined(USE_CPU_DISPATCH)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace {
+  using namespace Bitboard;
+
+  inline uint64_t flip_bb(uint64_t b)
+  {
+#ifdef _MSC_VER
+    return _byteswap_uint64(b);
+#else
+    return __builtin_bswap64(b);
+#endif
+  }
+
+  // The kernel, once for the flags of the build and, with CPU dispatch,
+  // once more for each level of CPU::Level
+  namespace Generic {
+#include "leafkernel.h"
+  }
+#ifdef USE_CPU_DISPATCH
+BEGIN_TARGET("popcnt")
+  namespace Popcnt {
+#define KERNEL_POPCNT
+#include "leafkernel.h"
+#undef KERNEL_POPCNT
+  }
+END_TARGET()
+BEGIN_TARGET("popcnt,bmi,bmi2,avx2")
+  namespace Avx2 {
+#define KERNEL_AVX2
+#include "leafkernel.h"
+#undef KERNEL_AVX2
+  }
+END_TARGET()
+
+  typedef uint64_t (*CountKernel)(const uint64_t lanes[][LeafBatch::Width]);
+  const CountKernel CountKernels[CPU::LEVEL_NB] = {
+    Generic::count_lanes, Popcnt::count_lanes, Avx2::count_lanes
+  };
+#endif
+}
+
+void LeafBatch::add(const Position& pos)
+{
+  if (pos.checkers() || pos.pinned() || (pos.ep_square() != Square::NONE)) {
+    total += MoveGen::count(pos);
+    return;
+  }
+
+  const Color::Type Us = pos.side_to_move(), Them = ~Us;
+  if (Us == Color::WHITE)
+    total += pos.can_castle_OO<Color::WHITE>() + pos.can_castle_OOO<Color::WHITE>();
+  else
+    total += pos.can_castle_OO<Color::BLACK>() + pos.can_castle_OOO<Color::BLACK>();
+
+  using namespace Piece;
+  const uint64_t Bitboards[BB_NB] = {
+    pos.pieces(make_piece(PAWN, Us)), pos.pieces(make_piece(KNIGHT, Us)),
+    pos.pieces(make_piece(BISHOP, Us), make_piece(QUEEN, Us)),
+    pos.pieces(make_piece(ROOK, Us), make_piece(QUEEN, Us)),
+    sq_mask(pos.king_square(Us)), pos.pieces(Us),
+    pos.pieces(make_piece(PAWN, Them)), pos.pieces(make_piece(KNIGHT, Them)),
+    pos.pieces(make_piece(BISHOP, Them), make_piece(QUEEN, Them)),
+    pos.pieces(make_piece(ROOK, Them), make_piece(QUEEN, Them)),
+    sq_mask(pos.king_square(Them)), pos.pieces(Them)
+  };
+  for (int bb = 0; bb < BB_NB; ++bb)
+    lanes[bb][n] = Us == Color::WHITE ? Bitboards[bb] : flip_bb(Bitboards[bb]);
+
+  if (++n == Width) {
+    count_lanes();
+    n = 0;
+  }
+}
+
+// Count the moves of the positions in the lanes, adding them to 'total',
+// with the kernel for this CPU
+void LeafBatch::count_lanes()
+{
+#ifdef USE_CPU_DISPATCH
+  total += CountKernels[CPU::Current](lanes);
+#else
+  total += Generic::count_lanes(lanes);
+#endif
+}
+
+// Count the positions still queued, and return the count of all positions
+// added since the last flush
+uint64_t LeafBatch::flush()
+{
+  if (n) {
+    // Empty lanes have no moves
+    for (int bb = 0; bb < BB_NB; ++bb)
+      for (size_t i = n; i < Width; ++i)
+        lanes[bb][i] = 0;
+    count_lanes();
+    n = 0;
+  }
+  const uint64_t Total = total;
+  total = 0;
+  return Total;
+}
@@ -0,0 +1,45 @@
+#ifndef INC_LEAFBATCH_H_
+#define INC_LEAFBATCH_H_
+#include "yaka.h"
+
+class Position;
+
+// Counts the legal moves of many positions, Width of them at once. A
+// position that isn't in check, has no pinned pieces and no en passant
+// square is queued, from the point of view of the side to move (flipped
+// vertically if that's black). A full batch is counted with set-wise
+// Kogge-Stone fills, one position per lane of an AVX2 register (or of a
+// plain array without AVX2). Other positions are counted by MoveGen
+// right away.
+//
+// A fill in one direction from a set of sliders gives disjoint rays, as
+// the ray of a slider stops at our slider in front of it, so the moves of
+// all sliders are the sum of the popcounts of the eight directions. The
+// same holds for the eight knight jumps.
+//
+// The kernel counting a batch is compiled once per instruction set (see
+// leafkernel.h and cpu.h).
+class LeafBatch {
+public:
+  static const size_t Width = 4;
+  // The bitboards of a position, one row of lanes each
+  enum {
+    Pawns, Knights, Diagonals, Orthogonals, King, Ours,
+    TheirPawns, TheirKnights, TheirDiagonals, TheirOrthogonals, TheirKing, Theirs,
+    BB_NB
+  };
+private:
+  alignas(32) uint64_t lanes[BB_NB][Width];
+  size_t n;
+  uint64_t total;
+
+  void count_lanes();
+public:
+  LeafBatch() : n(0), total(0) {}
+  ~LeafBatch() {}
+
+  void add(const Position& pos);
+  uint64_t flush();
+};
+
+#endif
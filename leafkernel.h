@@ -0,0 +1,186 @@
+// The kernel of LeafBatch, counting the moves of the positions in its
+// lanes. There is no include guard: leafbatch.cpp includes this once per
+// instruction set, each time in a namespace of its own. KERNEL_AVX2 keeps
+// the lanes in AVX2 registers and KERNEL_POPCNT counts plain arrays with
+// popcnt; without them the kernel is built for the flags of the build
+
+#if defined(KERNEL_AVX2) || defined(__AVX2__)
+// One bitboard per 64-bit lane of an AVX2 register
+struct Lanes {
+  __m256i v;
+  Lanes() {}
+  Lanes(__m256i v_) : v(v_) {}
+  static Lanes load(const uint64_t* p) { return _mm256_load_si256((const __m256i*)p); }
+  static Lanes fill(uint64_t b) { return _mm256_set1_epi64x((long long)b); }
+  void store(uint64_t* p) const { _mm256_store_si256((__m256i*)p, v); }
+};
+inline Lanes operator&(Lanes a, Lanes b) { return _mm256_and_si256(a.v, b.v); }
+inline Lanes operator|(Lanes a, Lanes b) { return _mm256_or_si256(a.v, b.v); }
+inline Lanes operator+(Lanes a, Lanes b) { return _mm256_add_epi64(a.v, b.v); }
+// a & ~b
+inline Lanes and_not(Lanes a, Lanes b) { return _mm256_andnot_si256(b.v, a.v); }
+
+template <int S> inline Lanes shl(Lanes a)
+{
+  return S >= 0 ? _mm256_slli_epi64(a.v, S >= 0 ? S : 0)
+    : _mm256_srli_epi64(a.v, S < 0 ? -S : 0);
+}
+
+// Per lane popcount: count the bits of every nibble with a lookup
+// through pshufb, then sum the bytes of each lane
+inline Lanes popcount(Lanes a)
+{
+  const __m256i Lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i LowNibbles = _mm256_set1_epi8(0x0F);
+  const __m256i Lo = _mm256_shuffle_epi8(Lookup, _mm256_and_si256(a.v, LowNibbles));
+  const __m256i Hi = _mm256_shuffle_epi8(Lookup,
+    _mm256_and_si256(_mm256_srli_epi16(a.v, 4), LowNibbles));
+  return _mm256_sad_epu8(_mm256_add_epi8(Lo, Hi), _mm256_setzero_si256());
+}
+#else
+// The same operations over a plain array
+struct Lanes {
+  uint64_t v[LeafBatch::Width];
+  static Lanes load(const uint64_t* p)
+  {
+    Lanes l;
+    for (size_t i = 0; i < LeafBatch::Width; ++i) l.v[i] = p[i];
+    return l;
+  }
+  static Lanes fill(uint64_t b)
+  {
+    Lanes l;
+    for (size_t i = 0; i < LeafBatch::Width; ++i) l.v[i] = b;
+    return l;
+  }
+  void store(uint64_t* p) const
+  {
+    for (size_t i = 0; i < LeafBatch::Width; ++i) p[i] = v[i];
+  }
+};
+
+#define LANEWISE(expr) \
+  Lanes r; \
+  for (size_t i = 0; i < LeafBatch::Width; ++i) r.v[i] = expr; \
+  return r
+inline Lanes operator&(Lanes a, Lanes b) { LANEWISE(a.v[i] & b.v[i]); }
+inline Lanes operator|(Lanes a, Lanes b) { LANEWISE(a.v[i] | b.v[i]); }
+inline Lanes operator+(Lanes a, Lanes b) { LANEWISE(a.v[i] + b.v[i]); }
+inline Lanes and_not(Lanes a, Lanes b) { LANEWISE(a.v[i] & ~b.v[i]); }
+template <int S> inline Lanes shl(Lanes a) {
+  LANEWISE(S >= 0 ? a.v[i] << (S >= 0 ? S : 0) : a.v[i] >> (S < 0 ? -S : 0));
+}
+#ifdef KERNEL_POPCNT
+inline Lanes popcount(Lanes a) { LANEWISE(uint64_t(__builtin_popcountll(a.v[i]))); }
+#else
+inline Lanes popcount(Lanes a) { LANEWISE(uint64_t(bit_count(a.v[i]))); }
+#endif
+#undef LANEWISE
+#endif
+
+// The files a shift by S moves a square, and the mask that drops the
+// squares wrapped around the board
+template <int S> struct Direction {
+  static const int FileDelta = ((S + 68) % 8) - 4;
+  static const uint64_t Mask =
+    FileDelta == 1 ? ~FileAMask : FileDelta == 2 ? ~(FileAMask | FileBMask)
+    : FileDelta == -1 ? ~FileHMask : FileDelta == -2 ? ~(FileGMask | FileHMask)
+    : Universe;
+};
+
+template <int S> inline Lanes shift(Lanes b)
+{
+  return shl<S>(b) & Lanes::fill(Direction<S>::Mask);
+}
+
+// Kogge-Stone occluded fill: the squares attacked in direction S by the
+// sliders in 'gen'
+template <int S> inline Lanes slide(Lanes gen, Lanes empty)
+{
+  const Lanes Mask = Lanes::fill(Direction<S>::Mask);
+  Lanes pro = empty & Mask;
+  gen = gen | (pro & shl<S>(gen));
+  pro = pro & shl<S>(pro);
+  gen = gen | (pro & shl<2 * S>(gen));
+  pro = pro & shl<2 * S>(pro);
+  gen = gen | (pro & shl<4 * S>(gen));
+  return shl<S>(gen) & Mask;
+}
+
+inline Lanes king_attacks(Lanes k)
+{
+  return shift<8>(k) | shift<-8>(k) | shift<1>(k) | shift<-1>(k)
+    | shift<9>(k) | shift<-9>(k) | shift<7>(k) | shift<-7>(k);
+}
+
+inline Lanes knight_attacks(Lanes n)
+{
+  return shift<17>(n) | shift<15>(n) | shift<10>(n) | shift<6>(n)
+    | shift<-17>(n) | shift<-15>(n) | shift<-10>(n) | shift<-6>(n);
+}
+
+// The moves of the positions in the lanes, all seen as white to move
+uint64_t count_lanes(const uint64_t lanes[][LeafBatch::Width])
+{
+  const Lanes Ours = Lanes::load(lanes[LeafBatch::Ours]);
+  const Lanes Theirs = Lanes::load(lanes[LeafBatch::Theirs]);
+  const Lanes Empty = and_not(Lanes::fill(Universe), Ours | Theirs);
+
+  // Squares attacked by them. With no check, none of their sliders sees
+  // our king, so the king doesn't hide any square behind it
+  const Lanes TheirPawns = Lanes::load(lanes[LeafBatch::TheirPawns]);
+  const Lanes TheirDiagonals = Lanes::load(lanes[LeafBatch::TheirDiagonals]);
+  const Lanes TheirOrthogonals = Lanes::load(lanes[LeafBatch::TheirOrthogonals]);
+  const Lanes Attacked = shift<-7>(TheirPawns) | shift<-9>(TheirPawns)
+    | knight_attacks(Lanes::load(lanes[LeafBatch::TheirKnights]))
+    | king_attacks(Lanes::load(lanes[LeafBatch::TheirKing]))
+    | slide<8>(TheirOrthogonals, Empty) | slide<-8>(TheirOrthogonals, Empty)
+    | slide<1>(TheirOrthogonals, Empty) | slide<-1>(TheirOrthogonals, Empty)
+    | slide<9>(TheirDiagonals, Empty) | slide<-9>(TheirDiagonals, Empty)
+    | slide<7>(TheirDiagonals, Empty) | slide<-7>(TheirDiagonals, Empty);
+
+  // King
+  Lanes count = popcount(and_not(king_attacks(Lanes::load(lanes[LeafBatch::King])), Ours | Attacked));
+
+  // Sliders and knights, direction by direction
+  const Lanes Orthogonals = Lanes::load(lanes[LeafBatch::Orthogonals]);
+  const Lanes Diagonals = Lanes::load(lanes[LeafBatch::Diagonals]);
+  const Lanes Knights = Lanes::load(lanes[LeafBatch::Knights]);
+  count = count
+    + popcount(and_not(slide<8>(Orthogonals, Empty), Ours))
+    + popcount(and_not(slide<-8>(Orthogonals, Empty), Ours))
+    + popcount(and_not(slide<1>(Orthogonals, Empty), Ours))
+    + popcount(and_not(slide<-1>(Orthogonals, Empty), Ours))
+    + popcount(and_not(slide<9>(Diagonals, Empty), Ours))
+    + popcount(and_not(slide<-9>(Diagonals, Empty), Ours))
+    + popcount(and_not(slide<7>(Diagonals, Empty), Ours))
+    + popcount(and_not(slide<-7>(Diagonals, Empty), Ours))
+    + popcount(and_not(shift<17>(Knights), Ours))
+    + popcount(and_not(shift<15>(Knights), Ours))
+    + popcount(and_not(shift<10>(Knights), Ours))
+    + popcount(and_not(shift<6>(Knights), Ours))
+    + popcount(and_not(shift<-17>(Knights), Ours))
+    + popcount(and_not(shift<-15>(Knights), Ours))
+    + popcount(and_not(shift<-10>(Knights), Ours))
+    + popcount(and_not(shift<-6>(Knights), Ours));
+
+  // Pawns. A move to the eighth rank makes four promotions
+  const Lanes Pawns = Lanes::load(lanes[LeafBatch::Pawns]);
+  const Lanes Rank8 = Lanes::fill(Rank8Mask);
+  const Lanes Single = shift<8>(Pawns) & Empty;
+  const Lanes Double = shift<8>(Single & Lanes::fill(Rank3Mask)) & Empty;
+  const Lanes CapturesLeft = shift<7>(Pawns) & Theirs;
+  const Lanes CapturesRight = shift<9>(Pawns) & Theirs;
+  const Lanes Promotions = popcount(Single & Rank8) + popcount(CapturesLeft & Rank8)
+    + popcount(CapturesRight & Rank8);
+  count = count + popcount(Single) + popcount(Double) + popcount(CapturesLeft)
+    + popcount(CapturesRight) + Promotions + Promotions + Promotions;
+
+  alignas(32) uint64_t counts[LeafBatch::Width];
+  count.store(counts);
+  uint64_t total = 0;
+  for (size_t i = 0; i < LeafBatch::Width; ++i)
+    total += counts[i];
+  return total;
+}
@@ -9,15 +9,28 @@
 #include "movegen.h"
 #include "misc.h"
 #include "timer.h"
+#include "benchmarker.h"
+#include "cpu.h"
 
-int main()
+int main(int argc, char* argv[])
 {
   using namespace std;
-  Bitboard::init();
+  CPU::init();
   Attacks::init();
-  Zobrist::init();
   Scores::init();
 
+  // A worker process of a distributed perft (see the 'dperft' command):
+  // perftworker <depth> <hash MB>, FENs given on the standard input
+  if ((argc > 3) && (string(argv[1]) == "perftworker")) {
+    Position pos;
+    PerftBench pb(pos, cout);
+    size_t hash_mb = Misc::convert_to<size_t>(argv[3]);
+    if (hash_mb)
+      pb.allocate_hash(hash_mb);
+    pb.perft_worker(Misc::convert_to<depth_t>(argv[2]), cin);
+    return 0;
+  }
+
   UCI uci;
   uci.uci_loop();
   system("PAUSE");
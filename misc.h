@@ -4,6 +4,10 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <cstdint>
+#if defined(_MSC_VER) && defined(_WIN64)
+#include <intrin.h>
+#endif
 namespace Misc {
   void split_string(const std::string &str_, std::vector<std::string> * v);
   std::ostream& hash(std::ostream& os);
@@ -13,9 +17,26 @@ namespace Misc {
   T convert_to(const std::string& str)
   {
     T temp;
-    std::stringstream ss(str);
+    std::stringstream ss(str);
     ss >> temp;
     return temp;
   }
+
+  // The high 64 bits of a * b. For a hash 'a', this maps it onto [0, b)
+  // with a multiplication instead of a division
+  inline uint64_t mul_hi64(uint64_t a, uint64_t b)
+  {
+#if defined(_MSC_VER) && defined(_WIN64)
+    return __umulh(a, b);
+#elif defined(__SIZEOF_INT128__)
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    const uint64_t ALo = a & 0xFFFFFFFFULL, AHi = a >> 32;
+    const uint64_t BLo = b & 0xFFFFFFFFULL, BHi = b >> 32;
+    const uint64_t Mid = ((ALo * BLo) >> 32) + ((AHi * BLo) & 0xFFFFFFFFULL)
+      + ((ALo * BHi) & 0xFFFFFFFFULL);
+    return AHi * BHi + ((AHi * BLo) >> 32) + ((ALo * BHi) >> 32) + (Mid >> 32);
+#endif
+  }
 }
 #endif
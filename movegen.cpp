@@ -3,36 +3,63 @@
 #include "attacks.h"
 #include <sstream>
 
+template <MoveGen::Mode M, bool Count>
 void MoveGen::generate() {
-  if (pos.checkers())
-    pos.side_to_move() == Color::WHITE ? generate_evasions<Color::WHITE>()
-    : generate_evasions<Color::BLACK>();
+  assert((M == All) || ((M == Evasions) == (pos.checkers() != 0)));
+  if ((M == Evasions) || ((M == All) && pos.checkers()))
+    pos.side_to_move() == Color::WHITE ? generate_evasions<Color::WHITE, Count>()
+    : generate_evasions<Color::BLACK, Count>();
   else {
-    const uint64_t Target = ~pos.pieces(pos.side_to_move());
+    // Quiet checks are picked from the quiet moves
+    const Mode Gen = M == QuietChecks ? Quiets : M;
+    const uint64_t Target = Gen == Captures ? pos.pieces(~pos.side_to_move())
+      : Gen == Quiets ? ~pos.all_pieces() : ~pos.pieces(pos.side_to_move());
     if (pos.side_to_move() == Color::WHITE) {
-      generate_all<Color::WHITE>(Target);
-      gen_king_moves<Color::WHITE>(Target);
-      gen_pawn_moves<Color::WHITE>();
+      generate_all<Color::WHITE, Count>(Target);
+      gen_king_moves<Color::WHITE, Count, false, Gen != Captures>(Target);
+      gen_pawn_moves<Color::WHITE, Count, Gen>();
     }
     else {
-      generate_all<Color::BLACK>(Target);
-      gen_king_moves<Color::BLACK>(Target);
-      gen_pawn_moves<Color::BLACK>();
+      generate_all<Color::BLACK, Count>(Target);
+      gen_king_moves<Color::BLACK, Count, false, Gen != Captures>(Target);
+      gen_pawn_moves<Color::BLACK, Count, Gen>();
     }
+    if (M == QuietChecks)
+      keep_checks();
   }
   *end = Move::Type::NONE;
 }
 
-MoveGen::MoveGen(const Position& pos_) :
-  end(mstack), pos(pos_), NotPinned(~pos.pinned())
+MoveGen::MoveGen(const Position& pos_, Mode mode) :
+  end(mstack), n_counted(0), pos(pos_), NotPinned(~pos.pinned())
 {
-  generate();
+  switch (mode) {
+  case All:         generate<All>(); break;
+  case Captures:    generate<Captures>(); break;
+  case Quiets:      generate<Quiets>(); break;
+  case Evasions:    generate<Evasions>(); break;
+  case QuietChecks: generate<QuietChecks>(); break;
+  }
 }
 
-template <Color::Type Us>
+MoveGen::MoveGen(const Position& pos_, CountOnly) :
+  end(mstack), n_counted(0), pos(pos_), NotPinned(~pos.pinned())
+{
+}
+
+size_t MoveGen::count(const Position& pos)
+{
+  MoveGen movegen(pos, CountOnly());
+  movegen.generate<All, true>();
+  return movegen.n_counted;
+}
+
+template <Color::Type Us, bool Count, MoveGen::Mode M>
 void MoveGen::gen_pawn_moves(const uint64_t Target)
 {
   using namespace Bitboard;
+  const bool GenCaptures = M != Quiets;
+  const bool GenQuiets = M != Captures;
   const uint64_t FreeSquares = ~pos.all_pieces();
   const uint64_t CapSquares = pos.pieces(~Us) & Target;
 
@@ -45,9 +72,12 @@ void MoveGen::gen_pawn_moves(const uint64_t Target)
   // because pinned pawns can never promote
   if (Target & (Rank7Mask >> (Us * 8 * 5)))
     if (pawns = pos.pawns(Us) & (Rank7Mask >> (Us * 8 * 5)) & NotPinned) {
-      add_promotions<9 * One>(pawns, CapSquares);  // Right Direction
-      add_promotions<7 * One>(pawns, CapSquares);  // Left  Direction
-      add_promotions<8 * One>(pawns, FreeSquares & Target); // Non-capture, up
+      if (GenCaptures) {
+        add_promotions<Count, 9 * One>(pawns, CapSquares);  // Right Direction
+        add_promotions<Count, 7 * One>(pawns, CapSquares);  // Left  Direction
+      }
+      // Non-capture, up. The queen promotion counts as a capture
+      add_promotions<Count, 8 * One, GenCaptures, GenQuiets>(pawns, FreeSquares & Target);
     }
 
   // We mask out the pawns that are not on Rank 7 for white or
@@ -56,59 +86,60 @@ void MoveGen::gen_pawn_moves(const uint64_t Target)
   const uint64_t Pawns = pos.pawns(Us) & ~(Rank7Mask >> (Us * 8 * 5));
   pawns = Pawns & NotPinned;
   // Now generate pawn captures.
-  add_pawn_captures<9 * One>(pawns, CapSquares);
-  add_pawn_captures<7 * One>(pawns, CapSquares);
+  if (GenCaptures) {
+    add_pawn_captures<Count, 9 * One>(pawns, CapSquares);
+    add_pawn_captures<Count, 7 * One>(pawns, CapSquares);
+  }
 
   // Pinned pawn move generation
   if (Target == Universe) { // Not in check
     pawns = pos.pawns(Us) & pos.pinned();
 
-    b1 = shift_bb<8 * One>(pawns & Pawns) & FreeSquares & Attacks::FileMaskEx[pos.king_square(Us)];
-    add_pinned_pawn_move<false, 8 * One, Us>(b1 & Target);
-    add_pinned_pawn_move<false, 16 * One, Us>(shift_bb<8 * One>(b1 & (Rank3Mask << (Us * 3 * 8)))
-                                              & FreeSquares & Target);
-
-    // Exclude pawns behind or on sides of king. They can't legally capture
-    pawns &= Attacks::FrontSquares[Us][pos.king_square(Us)];
-    assert(Bitboard::bit_count(pawns) <= 3);  // There can only be two such pawns
-    add_pinned_pawn_move<true, 7 * One, Us>(shift_bb<7 * One>(pawns) & CapSquares &
-                                            Attacks::ADiagMaskEx[pos.king_square(Us)]);
-    add_pinned_pawn_move<true, 9 * One, Us>(shift_bb<9 * One>(pawns) & CapSquares &
-                                            Attacks::DiagMaskEx[pos.king_square(Us)]);
+    if (GenQuiets) {
+      b1 = shift_bb<8 * One>(pawns & Pawns) & FreeSquares & Attacks::FileMaskEx[pos.king_square(Us)];
+      add_pinned_pawn_move<Count, false, 8 * One, Us>(b1 & Target);
+      add_pinned_pawn_move<Count, false, 16 * One, Us>(shift_bb<8 * One>(b1 & (Rank3Mask << (Us * 3 * 8)))
+                                                & FreeSquares & Target);
+    }
+    if (GenCaptures) {
+      // Exclude pawns behind or on sides of king. They can't legally capture
+      pawns &= Attacks::FrontSquares[Us][pos.king_square(Us)];
+      assert(Bitboard::bit_count(pawns) <= 3);  // There can only be two such pawns
+      add_pinned_pawn_move<Count, true, 7 * One, Us>(shift_bb<7 * One>(pawns) & CapSquares &
+                                              Attacks::ADiagMaskEx[pos.king_square(Us)]);
+      add_pinned_pawn_move<Count, true, 9 * One, Us>(shift_bb<9 * One>(pawns) & CapSquares &
+                                              Attacks::DiagMaskEx[pos.king_square(Us)]);
+    }
   }
 
   // Now, normal pawn pushes
-  b1 = shift_bb<8 * One>(Pawns & NotPinned) & FreeSquares;
-  b2 = shift_bb<8 * One>(b1 & (Rank3Mask << (Us * 3 * 8))) & FreeSquares;
-  if (b1 &= Target) do {
-    Square::Type to = lsb(b1);
-    add_move(to - (8 * One), to);
-  } while (b1 &= b1 - 1);
-
-  // TODO : Try using a flag for double pawn pushes
-  if (b2 &= Target) do {
-    Square::Type to = lsb(b2);
-    add_move(to - (16 * One), to);
-  } while (b2 &= b2 - 1);
+  if (GenQuiets) {
+    b1 = shift_bb<8 * One>(Pawns & NotPinned) & FreeSquares;
+    b2 = shift_bb<8 * One>(b1 & (Rank3Mask << (Us * 3 * 8))) & FreeSquares;
+    add_pawn_moves<Count, 8 * One>(b1 & Target);
+
+    // TODO : Try using a flag for double pawn pushes
+    add_pawn_moves<Count, 16 * One>(b2 & Target);
+  }
 
   // Now generate En-passant captures
-  if ((pos.ep_square() != Square::NONE) && bit_set(Target, pos.ep_square() - (8 * One))) {
+  if (GenCaptures && (pos.ep_square() != Square::NONE) && bit_set(Target, pos.ep_square() - (8 * One))) {
     uint64_t b = Pawns & Attacks::PawnAttacks[!Us][pos.ep_square()];
     if (b) do {
       Square::Type from = lsb(b);
       const uint64_t Occ =
         (pos.all_pieces() ^ sq_mask(from, pos.ep_square() - (8 * One))) | sq_mask(pos.ep_square());
       using TheirPcs = Piece::PieceOfColor < Color::Type(!Us) > ;
-      if (!(Attacks::slider_attacks<Piece::ROOK>(pos.king_square(Us), Occ)
+      if (!(Attacks::slider_lookup<Piece::ROOK>(pos.king_square(Us), Occ)
         & pos.pieces(TheirPcs::Rook, TheirPcs::Queen))
-        && !(Attacks::slider_attacks<Piece::BISHOP>(pos.king_square(Us), Occ)
+        && !(Attacks::slider_lookup<Piece::BISHOP>(pos.king_square(Us), Occ)
         & pos.pieces(TheirPcs::Bishop, TheirPcs::Queen)))
-        add_move<Move::Flags::ENPASSANT>(from, pos.ep_square());
+        add_move<Count, Move::Flags::ENPASSANT>(from, pos.ep_square());
     } while (b &= b - 1);
   }
 }
 
-template <Piece::PieceType P>
+template <Piece::PieceType P, bool Count>
 void MoveGen::gen_slider_moves(uint64_t pieces, uint64_t target)
 {
   static_assert((P == Piece::ROOK) || (P == Piece::BISHOP) || (P == Piece::QUEEN),
@@ -118,18 +149,18 @@ void MoveGen::gen_slider_moves(uint64_t pieces, uint64_t target)
   // Generation for non pinned pieces
   if (pc = pieces & NotPinned) do {
     Square::Type from = Bitboard::lsb(pc);
-    add_moves(from, Attacks::slider_attacks<P>(from, pos.all_pieces()) & target);
+    add_moves<Count>(from, Attacks::slider_lookup<P>(from, pos.all_pieces()) & target);
   } while (pc &= pc - 1);
 
   // Generation for pinned pieces
   if (pc = pieces & pos.pinned()) do {
     Square::Type from = Bitboard::lsb(pc);
-    add_moves(from, Attacks::slider_attacks<P>(from, pos.all_pieces()) & target &
+    add_moves<Count>(from, Attacks::slider_lookup<P>(from, pos.all_pieces()) & target &
               Attacks::LineBetween[from][pos.king_square(pos.side_to_move())]);
   } while (pc &= pc - 1);
 }
 
-template <Color::Type Us, bool InCheck>
+template <Color::Type Us, bool Count, bool InCheck, bool Castling>
 void MoveGen::gen_king_moves(uint64_t target)
 {
   using namespace Attacks;
@@ -146,30 +177,49 @@ void MoveGen::gen_king_moves(uint64_t target)
     } while (sliders &= sliders - 1);
   }
 
+  // Drop the attacked squares, with one attack map of theirs if there
+  // are enough squares to test
+  if (Bitboard::bit_count(king_attacks) > 2)
+    king_attacks &= ~pos.attacked_squares<Us>(pos.all_pieces());
+  else if (king_attacks) {
+    uint64_t b = king_attacks;
+    do {
+      if (pos.is_attacked<Us>(Bitboard::lsb(b)))
+        king_attacks ^= Bitboard::sq_mask(Bitboard::lsb(b));
+    } while (b &= b - 1);
+  }
   if (king_attacks) do {
-    Square::Type to = Bitboard::lsb(king_attacks);
-    if (pos.is_attacked<Us>(to))
-      continue;  // Illegal move
-    add_move(pos.king_square(Us), to);
+    add_move<Count>(pos.king_square(Us), Bitboard::lsb(king_attacks));
   } while (king_attacks &= king_attacks - 1);
 
-  if (InCheck) return;
+  if (InCheck || !Castling) return;
   if (pos.can_castle_OO<Us>())
-    add_move<Move::Flags::CASTLING>(Square::flip<Us>(Square::E1), Square::flip<Us>(Square::G1));
+    add_move<Count, Move::Flags::CASTLING>(Square::flip<Us>(Square::E1), Square::flip<Us>(Square::G1));
   if (pos.can_castle_OOO<Us>())
-    add_move<Move::Flags::CASTLING>(Square::flip<Us>(Square::E1), Square::flip<Us>(Square::C1));
+    add_move<Count, Move::Flags::CASTLING>(Square::flip<Us>(Square::E1), Square::flip<Us>(Square::C1));
 }
 
+template <bool Count>
 void MoveGen::gen_knight_moves(uint64_t target)
 {
   // A pinned knight can't legally move
   uint64_t knights = pos.pieces(Piece::make_piece(Piece::KNIGHT, pos.side_to_move())) & NotPinned;
   if (knights) do {
     Square::Type from = Bitboard::lsb(knights);
-    add_moves(from, Attacks::KnightAttacks[from] & target);
+    add_moves<Count>(from, Attacks::KnightAttacks[from] & target);
   } while (knights &= knights - 1);
 }
 
+// Drop the moves that don't give check
+void MoveGen::keep_checks()
+{
+  Move::Type * out = mstack;
+  for (Move::Type * mlist_ptr = mstack; mlist_ptr != end; ++mlist_ptr)
+    if (pos.gives_check(*mlist_ptr))
+      *out++ = *mlist_ptr;
+  end = out;
+}
+
 std::string MoveGen::to_str() const
 {
   std::ostringstream out;
@@ -6,15 +6,29 @@
 class Position;
 
 class MoveGen {
+public:
+  // The moves generated. Captures (with all capture promotions, en passant
+  // and queen promotions), Quiets (everything else) and QuietChecks (the
+  // quiet moves that give check) are for positions not in check; Evasions
+  // only for positions in check. All picks Evasions or Captures + Quiets
+  enum Mode { All, Captures, Quiets, Evasions, QuietChecks };
+private:
   Move::Type mstack[Move::MaxMoves];
   Move::Type * end;
+  size_t n_counted;  // Number of legal moves, in counting mode
   const Position& pos;
   const uint64_t NotPinned;
+
+  struct CountOnly {};
+  MoveGen(const Position& pos_, CountOnly);
 public:
   MoveGen() = delete;
-  MoveGen(const Position& pos_);
+  MoveGen(const Position& pos_, Mode mode = All);
   ~MoveGen() {}
 
+  // Number of legal moves in pos, counted without generating them
+  static size_t count(const Position& pos);
+
   Move::Type* begin()
   {
     return mstack;
@@ -35,92 +49,113 @@ public:
     return end - mstack;
   }
 
-  template <Move::Flags Flag = Move::Flags::NONE, Piece::PieceType Prom = Piece::KNIGHT>
+  // All the functions below take a 'Count' parameter. If it is set, moves
+  // are only counted in n_counted, mostly by popcounts of the target
+  // bitboards, and nothing is written to mstack
+
+  template <bool Count, Move::Flags Flag = Move::Flags::NONE, Piece::PieceType Prom = Piece::KNIGHT>
   void add_move(Square::Type from, Square::Type to)
   {
-    *end++ = Move::make_move<Flag, Prom>(from, to);
+    if (Count) ++n_counted;
+    else *end++ = Move::make_move<Flag, Prom>(from, to);
   }
 
+  template <bool Count>
   void add_moves(Square::Type from, uint64_t attacks)
   {
-    if (attacks) do
+    if (Count) n_counted += Bitboard::bit_count(attacks);
+    else if (attacks) do
       *end++ = Move::make_move(from, Bitboard::lsb(attacks));
     while (attacks &= attacks - 1);
   }
 
-  template <int Dir>
+  // Add the moves of pawns to the squares in 'b', all from 'Dir' behind
+  template <bool Count, int Dir>
+  void add_pawn_moves(uint64_t b)
+  {
+    if (Count) n_counted += Bitboard::bit_count(b);
+    else if (b) do {
+      Square::Type to = Bitboard::lsb(b);
+      add_move<false>(to - Dir, to);
+    } while (b &= b - 1);
+  }
+
+  // 'Queen' and 'Under' select the queen promotions and the under
+  // promotions
+  template <bool Count, int Dir, bool Queen = true, bool Under = true>
   void add_promotions(uint64_t pawns, uint64_t target)
   {
     pawns = Bitboard::shift_bb<Dir>(pawns) & target;
-    if (pawns) do {
+    if (Count) n_counted += (Queen + 3 * Under) * Bitboard::bit_count(pawns);
+    else if (pawns) do {
       Square::Type to = Bitboard::lsb(pawns);
       Square::Type from = to - Dir;
-      add_move<Move::Flags::PROMOTION, Piece::QUEEN>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::KNIGHT>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::ROOK>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::BISHOP>(from, to);
+      if (Queen)
+        add_move<false, Move::Flags::PROMOTION, Piece::QUEEN>(from, to);
+      if (Under) {
+        add_move<false, Move::Flags::PROMOTION, Piece::KNIGHT>(from, to);
+        add_move<false, Move::Flags::PROMOTION, Piece::ROOK>(from, to);
+        add_move<false, Move::Flags::PROMOTION, Piece::BISHOP>(from, to);
+      }
     } while (pawns &= pawns - 1);
   }
 
-  template <int Dir>
+  template <bool Count, int Dir>
   void add_pawn_captures(uint64_t pawns, uint64_t target)
   {
-    pawns = Bitboard::shift_bb<Dir>(pawns) & target;
-    if (pawns) do {
-      Square::Type to = Bitboard::lsb(pawns);
-      add_move(to - Dir, to);
-    } while (pawns &= pawns - 1);
+    add_pawn_moves<Count, Dir>(Bitboard::shift_bb<Dir>(pawns) & target);
   }
 
-  template <bool Capture, int Dir, Color::Type Us>
+  template <bool Count, bool Capture, int Dir, Color::Type Us>
   void add_pinned_pawn_move(const uint64_t b)
   {
     assert(!Bitboard::more_than_one(b));
     if (Capture && (b & (Bitboard::Rank8Mask >> (Us * 8 * 7)))) {
       Square::Type to = Bitboard::lsb(b);
       Square::Type from = to - Dir;
-      add_move<Move::Flags::PROMOTION, Piece::QUEEN>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::KNIGHT>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::ROOK>(from, to);
-      add_move<Move::Flags::PROMOTION, Piece::BISHOP>(from, to);
+      add_move<Count, Move::Flags::PROMOTION, Piece::QUEEN>(from, to);
+      add_move<Count, Move::Flags::PROMOTION, Piece::KNIGHT>(from, to);
+      add_move<Count, Move::Flags::PROMOTION, Piece::ROOK>(from, to);
+      add_move<Count, Move::Flags::PROMOTION, Piece::BISHOP>(from, to);
     } else if (b) {
       Square::Type to = Bitboard::lsb(b);
-      add_move(to - Dir, to);
+      add_move<Count>(to - Dir, to);
     }
   }
 
-  template <Color::Type Us>
+  template <Color::Type Us, bool Count, Mode M = All>
   void gen_pawn_moves(const uint64_t Target = Bitboard::Universe);
-  template <Color::Type Us, bool InCheck = false>
+  template <Color::Type Us, bool Count, bool InCheck = false, bool Castling = !InCheck>
   void gen_king_moves(uint64_t target);
-  void gen_knight_moves(uint64_t target);
-  template <Piece::PieceType P> void gen_slider_moves(uint64_t pieces, uint64_t target);
-  template <Color::Type Us> void generate_all(const uint64_t Target)
+  template <bool Count> void gen_knight_moves(uint64_t target);
+  template <Piece::PieceType P, bool Count> void gen_slider_moves(uint64_t pieces, uint64_t target);
+  template <Color::Type Us, bool Count> void generate_all(const uint64_t Target)
   {
     using OurPieces = Piece::PieceOfColor < Us > ;
-    gen_slider_moves<Piece::ROOK>(pos.pieces(OurPieces::Rook, OurPieces::Queen), Target);
-    gen_slider_moves<Piece::BISHOP>(pos.pieces(OurPieces::Bishop, OurPieces::Queen), Target);
-    gen_knight_moves(Target);
+    gen_slider_moves<Piece::ROOK, Count>(pos.pieces(OurPieces::Rook, OurPieces::Queen), Target);
+    gen_slider_moves<Piece::BISHOP, Count>(pos.pieces(OurPieces::Bishop, OurPieces::Queen), Target);
+    gen_knight_moves<Count>(Target);
   }
 
-  template <Color::Type Us> void generate_evasions()
+  template <Color::Type Us, bool Count> void generate_evasions()
   {
     assert(Us == pos.side_to_move());
-    gen_king_moves<Us, true>(~pos.pieces(Us));
+    gen_king_moves<Us, Count, true>(~pos.pieces(Us));
     if (!Bitboard::more_than_one(pos.checkers())) {
       // Not a double check, there might be other possible evasions
       Square::Type sq = Bitboard::lsb(pos.checkers());
       uint64_t target = Attacks::SqBetween[pos.king_square(Us)][sq];
       target |= Bitboard::sq_mask(sq);
       using OurPieces = Piece::PieceOfColor < Us > ;
-      gen_slider_moves<Piece::ROOK>(pos.pieces(OurPieces::Rook, OurPieces::Queen) & NotPinned, target);
-      gen_slider_moves<Piece::BISHOP>(pos.pieces(OurPieces::Bishop, OurPieces::Queen) & NotPinned, target);
-      gen_knight_moves(target);
-      gen_pawn_moves<Us>(target);
+      gen_slider_moves<Piece::ROOK, Count>(pos.pieces(OurPieces::Rook, OurPieces::Queen) & NotPinned, target);
+      gen_slider_moves<Piece::BISHOP, Count>(pos.pieces(OurPieces::Bishop, OurPieces::Queen) & NotPinned, target);
+      gen_knight_moves<Count>(target);
+      gen_pawn_moves<Us, Count>(target);
     }
   }
 
-  void generate();
+  template <Mode M = All, bool Count = false> void generate();
+  void keep_checks();
   std::string to_str() const;
 };
 
@@ -1,54 +1,141 @@
 #include "movepicker.h"
-#include "movegen.h"
 
-MovePicker::MovePicker(const Position& pos_) : pos(pos_) {
+namespace {
+  const int MVVLVA_Value[Piece::PIECE_NB] = { 1, 1, 2, 2, 2, 2, 3, 3, 5, 5 };
+
+  // Puts the captures ahead of the quiet moves among the evasions
+  const int EvasionCaptureBonus = 1000;
+}
+
+Heuristics::Heuristics(const Position& pos_) : pos(pos_) {
   reset();
 }
 
-void MovePicker::score_moves(ScoredMoveList& move_list, depth_t ply, Move::Type hash_move)
+MovePicker::MovePicker(const Position& pos_, const Heuristics& heuristics_,
+  depth_t ply_, Move::Type hash_move_) :
+  pos(pos_), heuristics(heuristics_), ply(ply_), hash_move(hash_move_),
+  stage(HashMove), killer_idx(0), cur(moves), end(moves), bad_end(moves)
 {
-  size_t idx;
-  for (idx = 0; move_list.mlist[idx] != Move::Type::NONE; ++idx) {
-    const Move::Type m = move_list.mlist[idx];
-
-    int score = 0;
-
-    if (pos.piece(Move::to_sq(m)) != Piece::NONE) { // Capture, score by MVVLVA
-      score = 8 * MVVLVA_Value[pos.piece(Move::to_sq(m))];
-      score -= MVVLVA_Value[pos.piece(Move::from_sq(m))];
-      if (Move::is_move(m, Move::Flags::PROMOTION))
-        score += 32 * MVVLVA_Value[Move::promotion_pc(m) << 1];
-      score *= 3;
-    }
-    else {  // Non capture, score by Killer and Relative History Heuristic
-      score = killer_score(m, ply);
-      if (UseHistoryHeuristics)
-        score += rhh_score(m);
-    }
+}
 
-    if (m == hash_move)
-      score += 1000;
+// Score a capture or a queen promotion by MVV/LVA
+int MovePicker::capture_score(Move::Type m) const
+{
+  const Piece::Type Victim = Move::flags(m) == Move::Flags::ENPASSANT ?
+    Piece::make_piece(Piece::PAWN, ~pos.side_to_move()) : pos.piece(Move::to_sq(m));
+  int score = 8 * MVVLVA_Value[Victim];
+  score -= MVVLVA_Value[pos.piece(Move::from_sq(m))];
+  if (Move::flags(m) == Move::Flags::PROMOTION)
+    score += 32 * MVVLVA_Value[Move::promotion_pc(m) << 1];
+  return 3 * score;
+}
 
-    move_list.score_list[idx] = score;
+// Generate the moves of 'mode' after the moves already in the list
+void MovePicker::generate(MoveGen::Mode mode)
+{
+  MoveGen movegen(pos, mode);
+  cur = end;
+  for (size_t i = 0; i < movegen.size(); ++i) {
+    const Move::Type M = movegen[i];
+    int score;
+    if (is_quiet(M))
+      score = UseHistoryHeuristics ? heuristics.rhh_score(M) : 0;
+    else
+      score = capture_score(M) + (mode == MoveGen::Evasions ? EvasionCaptureBonus : 0);
+    *end++ = { M, score };
   }
 }
 
-Move::Type MovePicker::get_next_move(ScoredMoveList& move_list, size_t idx)
+// Move the best scored move left into 'cur'
+void MovePicker::pick_best()
 {
-  int score, best_score = move_list.score_list[idx];
-  size_t m = idx; // m = index of the best move
-  for (size_t n = idx + 1; move_list.mlist[n] != Move::Type::NONE; ++n) {
-    score = move_list.score_list[n];
-    if (score > best_score) {
-      best_score = score;
-      m = n;
-    }
-  }
+  ScoredMove* best = cur;
+  for (ScoredMove* p = cur + 1; p != end; ++p)
+    if (p->score > best->score)
+      best = p;
+  std::swap(*cur, *best);
+}
 
-  if (idx != m) {
-    std::swap(move_list.mlist[idx], move_list.mlist[m]);
-    std::swap(move_list.score_list[idx], move_list.score_list[m]);
-  }
+// The next move to search, Move::Type::NONE once all were given out
+Move::Type MovePicker::next_move()
+{
+  while (true) {
+    switch (stage) {
+    case HashMove:
+      stage = pos.checkers() ? GenEvasions : GenCaptures;
+      if ((hash_move != Move::Type::NONE) && pos.is_ok(hash_move, false))
+        return hash_move;
+      break;
+
+    case GenCaptures:
+      generate(MoveGen::Captures);
+      stage = GoodCaptures;
+      break;
+
+    case GoodCaptures:
+      while (cur != end) {
+        pick_best();
+        const ScoredMove Sm = *cur++;
+        if (Sm.move == hash_move)
+          continue;
+        if (pos.see(pos.side_to_move(), Sm.move) < 0)
+          *bad_end++ = Sm;  // Overwrites a move already given out
+        else
+          return Sm.move;
+      }
+      stage = Killers;
+      break;
+
+    case Killers:
+      while (killer_idx < 2) {
+        const Move::Type M = heuristics.killer(ply, killer_idx++);
+        if ((M != Move::Type::NONE) && (M != hash_move) && is_quiet(M) && pos.is_ok(M, false))
+          return M;
+      }
+      stage = GenQuiets;
+      break;
+
+    case GenQuiets:
+      generate(MoveGen::Quiets);
+      stage = Quiets;
+      break;
 
-  return move_list.mlist[idx];
+    case Quiets:
+      while (cur != end) {
+        if (UseHistoryHeuristics)
+          pick_best();
+        const Move::Type M = (cur++)->move;
+        if ((M != hash_move) && (M != heuristics.killer(ply, 0)) && (M != heuristics.killer(ply, 1)))
+          return M;
+      }
+      cur = moves;
+      end = bad_end;
+      stage = BadCaptures;
+      break;
+
+    case BadCaptures:
+      if (cur != end)
+        return (cur++)->move;
+      stage = Done;
+      break;
+
+    case GenEvasions:
+      generate(MoveGen::Evasions);
+      stage = Evasions;
+      break;
+
+    case Evasions:
+      while (cur != end) {
+        pick_best();
+        const Move::Type M = (cur++)->move;
+        if (M != hash_move)
+          return M;
+      }
+      stage = Done;
+      break;
+
+    case Done:
+      return Move::Type::NONE;
+    }
+  }
 }
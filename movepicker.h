@@ -3,21 +3,15 @@
 
 #include "yaka.h"
 #include "position.h"
+#include "movegen.h"
 #include <cmath>
 
-class MoveGen;
-
 struct ScoredMove
 {
   Move::Type move;
   int score;
 };
 
-typedef struct {
-  Move::Type* mlist;
-  int score_list[Move::MaxMoves];
-} ScoredMoveList;
-
 struct SortMoveList {
   bool operator()(const ScoredMove& m1, const ScoredMove& m2) const {
     return m1.score > m2.score;
@@ -25,43 +19,37 @@ struct SortMoveList {
 };
 
 const bool UseHistoryHeuristics = false;
-// Implementation of the relative history heuristics based move ordering
-class MovePicker
+// Killer moves and relative history heuristics, kept by the searcher from
+// node to node to order the quiet moves
+class Heuristics
 {
   const Position& pos;
 
-  int heuristics[Piece::PIECE_NB][Square::SQ_NB];
+  int history[Piece::PIECE_NB][Square::SQ_NB];
   Move::Type killer_list[MaxPly][2];
-  
+
 public:
-  const int Scale = 64;
-  const int KillerScore = 50;
   const depth_t MaxHistoryDepth = 5;
   const int MaxHistoryScore = 250;
-  const int MVVLVA_Value[Piece::PIECE_NB] = { 1, 1, 2, 2, 2, 2, 3, 3, 5, 5 };
 
-  MovePicker() = delete;
-  MovePicker(const Position& pos_);
-  ~MovePicker() {};
+  Heuristics() = delete;
+  Heuristics(const Position& pos_);
+  ~Heuristics() {};
 
   inline void reset();
 
-  inline void reg_beta_cutoff(ScoredMoveList& move_list,
-    size_t idx, depth_t ply, depth_t depth);
-
-  inline bool is_killer(Move::Type m, depth_t ply);
-  inline int rhh_score(Move::Type m);
-  inline int killer_score(Move::Type m, depth_t ply);
+  inline void reg_beta_cutoff(Move::Type m, const Move::Type* quiets,
+    size_t n_quiets, depth_t ply, depth_t depth);
 
-  void score_moves(ScoredMoveList& move_list, depth_t ply, Move::Type hash_move);
-  Move::Type get_next_move(ScoredMoveList& move_list, size_t idx);
+  inline Move::Type killer(depth_t ply, int i) const;
+  inline int rhh_score(Move::Type m) const;
 };
 
-// Register a beta cutoff and update related tables
-inline void MovePicker::reg_beta_cutoff(ScoredMoveList& move_list,
-  size_t idx, depth_t ply, depth_t depth)
+// Register a beta cutoff by move m and update related tables. 'quiets' are
+// the quiet moves searched before m at this node
+inline void Heuristics::reg_beta_cutoff(Move::Type m, const Move::Type* quiets,
+  size_t n_quiets, depth_t ply, depth_t depth)
 {
-  Move::Type m = move_list.mlist[idx];
   if (pos.piece(Move::to_sq(m)) != Piece::NONE)
     return;
 
@@ -77,7 +65,7 @@ inline void MovePicker::reg_beta_cutoff(ScoredMoveList& move_list,
     return;
 
   // Register history heuristics for this move
-  int& hi = heuristics[pos.piece(Move::from_sq(m))][Move::to_sq(m)];
+  int& hi = history[pos.piece(Move::from_sq(m))][Move::to_sq(m)];
   if (depth > MaxHistoryDepth)
     depth = MaxHistoryDepth;
   double x = log((double)depth);
@@ -88,38 +76,71 @@ inline void MovePicker::reg_beta_cutoff(ScoredMoveList& move_list,
     hi = MaxHistoryScore;
 
   // Register butterfly heuristics for previously tried moves
-  for (int i = (int)idx - 1; i >= 0; --i) {
-    Move::Type m = move_list.mlist[i];
-    if (pos.piece(Move::to_sq(m)) == Piece::NONE) {
-      heuristics[pos.piece(Move::from_sq(m))][Move::to_sq(m)] -= score;
-    }
-  }
+  for (size_t i = 0; i < n_quiets; ++i)
+    history[pos.piece(Move::from_sq(quiets[i]))][Move::to_sq(quiets[i])] -= score;
+}
+
+inline Move::Type Heuristics::killer(depth_t ply, int i) const
+{
+  return killer_list[ply][i];
 }
 
 // Get Relative History Heuristic score of the move
-inline int MovePicker::rhh_score(Move::Type m)
+inline int Heuristics::rhh_score(Move::Type m) const
 {
-  return heuristics[pos.piece(Move::from_sq(m))][Move::to_sq(m)];
+  return history[pos.piece(Move::from_sq(m))][Move::to_sq(m)];
 }
 
-inline bool MovePicker::is_killer(Move::Type m, depth_t ply) {
-  return (m == killer_list[ply][0]) || (m == killer_list[ply][1]);
+inline void Heuristics::reset() {
+  std::memset(history, 0, sizeof(history));
+  std::memset(killer_list, 0, sizeof(killer_list));
 }
 
-inline int MovePicker::killer_score(Move::Type m, depth_t ply)
+// Hands out the legal moves of a node one by one, in stages: the hash
+// move, the captures that don't lose material by SEE (by MVV/LVA), the
+// killers, the quiet moves (by history) and last the losing captures. A
+// stage is only generated once the moves before it are used up, so a
+// cutoff by the hash move or a capture saves generating the quiet moves. In
+// check, the evasions after the hash move are generated all at once
+class MovePicker
 {
-  if (m != killer_list[ply][0]) {
-    if (m != killer_list[ply][1])
-      return 0;
-    else
-      return KillerScore;
-  }
-  else return KillerScore + (KillerScore / 10);
-}
+  enum Stage {
+    HashMove, GenCaptures, GoodCaptures, Killers, GenQuiets, Quiets, BadCaptures,
+    GenEvasions, Evasions, Done
+  };
 
-inline void MovePicker::reset() {
-  std::memset(heuristics, 0, sizeof(heuristics));
-  std::memset(killer_list, 0, sizeof(killer_list));
+  const Position& pos;
+  const Heuristics& heuristics;
+  const depth_t ply;
+  const Move::Type hash_move;
+  Stage stage;
+  int killer_idx;
+
+  // Losing captures are moved to [moves, bad_end) as they are met
+  ScoredMove moves[Move::MaxMoves];
+  ScoredMove *cur, *end, *bad_end;
+
+  inline bool is_quiet(Move::Type m) const;
+  int capture_score(Move::Type m) const;
+  void generate(MoveGen::Mode mode);
+  void pick_best();
+public:
+  MovePicker() = delete;
+  MovePicker(const Position& pos_, const Heuristics& heuristics_, depth_t ply_,
+    Move::Type hash_move_);
+  ~MovePicker() {};
+
+  Move::Type next_move();
+};
+
+// Quiet in the sense of MoveGen::Quiets
+inline bool MovePicker::is_quiet(Move::Type m) const
+{
+  if (pos.piece(Move::to_sq(m)) != Piece::NONE)
+    return false;
+  if (Move::flags(m) == Move::Flags::ENPASSANT)
+    return false;
+  return (Move::flags(m) != Move::Flags::PROMOTION) || (Move::promotion_pc(m) != Piece::QUEEN);
 }
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef INC_PEXT_H_
+#define INC_PEXT_H_
+#include "yaka.h"
+#include "attacks.h"
+#include "cpu.h"
+#ifdef USE_PEXT
+#include <immintrin.h>
+
+// Slider attacks looked up by the BMI2 pext instruction. pext gathers the
+// bits of the occupancy under the mask of a square into a dense index, so
+// there are no magic numbers, no shifts and no gaps in the tables: each
+// square has exactly 2^(bits in its mask) entries, 841 kB in all. The masks
+// are the RMasks/BMasks of the magics
+namespace Attacks {
+  extern uint64_t RPextTables[];
+  extern uint64_t * RPextAttacks[Square::SQ_NB];
+  extern uint64_t BPextTables[];
+  extern uint64_t * BPextAttacks[Square::SQ_NB];
+
+  template <Piece::PieceType Pt> inline uint64_t pext_attacks(Square::Type sq, uint64_t occ)
+  {
+    if (Pt == Piece::ROOK) return RPextAttacks[sq][_pext_u64(occ, RMasks[sq])];
+    if (Pt == Piece::BISHOP) return BPextAttacks[sq][_pext_u64(occ, BMasks[sq])];
+    return pext_attacks<Piece::ROOK>(sq, occ) | pext_attacks<Piece::BISHOP>(sq, occ);
+  }
+}
+#endif
+
+namespace Attacks {
+  // The slider attacks used by the engine: by pext on USE_PEXT builds,
+  // unless YAKA_CPU lowered the CPU level below AVX2 (for CPUs with a slow
+  // pext), and by the magics otherwise
+  template <Piece::PieceType Pt> inline uint64_t slider_lookup(Square::Type sq, uint64_t occ)
+  {
+#ifdef USE_PEXT
+    if (CPU::Current >= CPU::AVX2)
+      return pext_attacks<Pt>(sq, occ);
+#endif
+    return slider_attacks<Pt>(sq, occ);
+  }
+}
+#endif
@@ -2,12 +2,34 @@
 #include "misc.h"
 #include <iostream>
 #include <algorithm>
+#include <cstddef>
+
+Position::Position(const Position& pos)
+{
+  *this = pos;
+}
+
+// The copy gets its own root game line, a copy of the current one of pos,
+// so it doesn't share the game lines of the moves made in pos
+Position& Position::operator=(const Position& pos)
+{
+  std::memcpy(board, pos.board, sizeof(board));
+  std::memcpy(piece_BB, pos.piece_BB, sizeof(piece_BB));
+  std::memcpy(color_BB, pos.color_BB, sizeof(color_BB));
+  root_line = *pos.game_line;
+  root_line.previous = nullptr;
+  game_line = &root_line;
+  game_ply = pos.game_ply;
+  return *this;
+}
+
 void Position::reset()
 {
-  std::memset(this, 0, sizeof(Position));
-  game_line.active_color = Color::NONE;
-  game_line.captured_piece = Piece::NONE;
-  game_line.ep_sq = Square::NONE;
+  std::memset(static_cast<void*>(this), 0, sizeof(Position));
+  game_line = &root_line;
+  game_line->active_color = Color::NONE;
+  game_line->captured_piece = Piece::NONE;
+  game_line->ep_sq = Square::NONE;
   for (Square::Type sq = Square::A1; sq <= Square::H8; ++sq)
     board[sq] = Piece::NONE;
 }
@@ -21,16 +43,55 @@ void Position::handle_error(const char * str)
 void Position::update()
 {
   using namespace Piece;
-  game_line.king_sq[Color::WHITE] = Bitboard::lsb(pieces(Piece::WHITE_KING));
-  game_line.king_sq[Color::BLACK] = Bitboard::lsb(pieces(Piece::BLACK_KING));
+  game_line->king_sq[Color::WHITE] = Bitboard::lsb(pieces(Piece::WHITE_KING));
+  game_line->king_sq[Color::BLACK] = Bitboard::lsb(pieces(Piece::BLACK_KING));
+
+  if (side_to_move() == Color::WHITE)
+    game_line->checking_pieces = attackers_to<Color::WHITE>(game_line->king_sq[Color::WHITE]);
+  else
+    game_line->checking_pieces = attackers_to<Color::BLACK>(game_line->king_sq[Color::BLACK]);
+  game_line->pinned_pieces = PinsUnknown;
+  set_check_info();
+}
 
-  if (side_to_move() == Color::WHITE) {
-    game_line.checking_pieces = attackers_to<Color::WHITE>(game_line.king_sq[Color::WHITE]);
-    game_line.pinned_pieces = pinned<Color::WHITE>();
-  } else {
-    game_line.checking_pieces = attackers_to<Color::BLACK>(game_line.king_sq[Color::BLACK]);
-    game_line.pinned_pieces = pinned<Color::BLACK>();
-  }
+// Returns the pieces of either color that alone stand between square sq
+// and a slider of color c aimed at it
+uint64_t Position::slider_blockers(Square::Type sq, Color::Type c) const
+{
+  using namespace Piece;
+  uint64_t snipers = pieces(make_piece(QUEEN, c), make_piece(ROOK, c)) &
+    *Attacks::RAttacks[sq];
+  snipers |= pieces(make_piece(QUEEN, c), make_piece(BISHOP, c)) &
+    *Attacks::BAttacks[sq];
+
+  uint64_t blockers = 0, b;
+
+  if (snipers) do {
+    b = Attacks::SqBetween[sq][Bitboard::lsb(snipers)] & all_pieces();
+
+    if (!Bitboard::more_than_one(b))
+      blockers |= b;
+  } while (snipers &= snipers - 1);
+
+  return blockers;
+}
+
+// Set the check squares and the discovered check candidates of the side
+// to move
+void Position::set_check_info()
+{
+  using namespace Piece;
+  const Color::Type Us = side_to_move(), Them = ~Us;
+  const Square::Type Ksq = king_square(Them);
+  uint64_t * const CheckSquares = game_line->check_squares;
+
+  CheckSquares[PAWN] = Attacks::PawnAttacks[Them][Ksq];
+  CheckSquares[KNIGHT] = Attacks::KnightAttacks[Ksq];
+  CheckSquares[BISHOP] = Attacks::slider_lookup<BISHOP>(Ksq, all_pieces());
+  CheckSquares[ROOK] = Attacks::slider_lookup<ROOK>(Ksq, all_pieces());
+  CheckSquares[QUEEN] = CheckSquares[BISHOP] | CheckSquares[ROOK];
+  CheckSquares[KING] = 0;
+  game_line->discoverers = slider_blockers(Ksq, Us) & pieces(Us);
 }
 
 void Position::parse_fen(const std::string &fen_str)
@@ -54,10 +115,10 @@ void Position::parse_fen(const std::string &fen_str)
   }
 
   if (fen[1][0] == 'w')
-    game_line.active_color = Color::WHITE;
+    game_line->active_color = Color::WHITE;
   else if (fen[1][0] == 'b') {
-    game_line.active_color = Color::BLACK;
-    game_line.key ^= Zobrist::SideHash;
+    game_line->active_color = Color::BLACK;
+    game_line->key ^= Zobrist::SideHash;
   } else handle_error("FEN PARSE ERROR: Invalid color");
 
   Castling::Right cr = Castling::NONE;
@@ -71,17 +132,17 @@ void Position::parse_fen(const std::string &fen_str)
     default: handle_error("FEN PARSE ERROR: Invalid Castling Flags");
     }
   }
-  game_line.castle_rights = cr;
-  game_line.key ^= Zobrist::CastlingHash[game_line.castle_rights];
+  game_line->castle_rights = cr;
+  game_line->key ^= Zobrist::CastlingHash[game_line->castle_rights];
 
-  game_line.ep_sq = Square::NONE;
+  game_line->ep_sq = Square::NONE;
   if (fen[3][0] != '-') {
-    game_line.ep_sq = Square::square_of(fen[3].c_str());
-    game_line.key ^= Zobrist::EpHash[game_line.ep_sq];
+    game_line->ep_sq = Square::square_of(fen[3].c_str());
+    game_line->key ^= Zobrist::EpHash[game_line->ep_sq];
   }
 
   if (fen.size() > 3)
-    game_line.fifty_move = Misc::convert_to<int>(fen[4]);
+    game_line->fifty_move = Misc::convert_to<int>(fen[4]);
 
   update();
   assert(is_ok());
@@ -94,14 +155,14 @@ std::string Position::to_fen() const
     for (Square::File fl = Square::FILE_A; fl <= Square::FILE_H; ++fl) {
 
       int empty = 0;
-      while (board[Square::square_of(fl, rk)] == Piece::NONE) {
+      while (piece(Square::square_of(fl, rk)) == Piece::NONE) {
         ++empty;
         if (++fl > Square::FILE_H) break;
       }
 
       if (empty) ss << empty;
 
-      if (fl <= Square::FILE_H) ss << Piece::PieceToChar[board[Square::square_of(fl, rk)]];
+      if (fl <= Square::FILE_H) ss << Piece::PieceToChar[piece(Square::square_of(fl, rk))];
     }
     if (rk > Square::RANK_1) ss << '/';
   }
@@ -109,7 +170,7 @@ std::string Position::to_fen() const
   ss << (side_to_move() == Color::WHITE ? " w " : " b ");
   ss << Castling::to_str(castling_rights()) << ' ';
   ss << Square::to_str(ep_square()) << ' ';
-  ss << game_line.fifty_move << ' ' << game_ply;
+  ss << game_line->fifty_move << ' ' << game_ply;
 
   return ss.str();
 }
@@ -122,14 +183,14 @@ std::string Position::to_str() const
     ss.width(3);
     ss << r + 1 << " |";
     for (Square::File f = Square::FILE_A; f <= Square::FILE_H; ++f)
-      ss << ' ' << Piece::PieceToChar[board[Square::square_of(f, r)]] << " |";
+      ss << ' ' << Piece::PieceToChar[piece(Square::square_of(f, r))] << " |";
     ss << '\n';
   }
   ss << "    +---+---+---+---+---+---+---+---+\n";
   ss << "      a   b   c   d   e   f   g   h  \n";
 
   ss << "Fen: " << to_fen() << std::endl;
-  ss << "Key: " << Misc::hash << game_line.key << Misc::unhash;
+  ss << "Key: " << Misc::hash << game_line->key << Misc::unhash;
   uint64_t b = pinned();
   if (b) ss << "\nPinned Pieces: ";
   while (b) {
@@ -148,49 +209,85 @@ std::string Position::to_str() const
 template <Color::Type Us>
 uint64_t Position::pinned() const
 {
-  using TheirPcs = Piece::PieceOfColor < Color::Type(!Us) > ;
-  uint64_t pinner = pieces(TheirPcs::Queen, TheirPcs::Rook) &
-    *Attacks::RAttacks[king_square(Us)];
-  pinner |= pieces(TheirPcs::Queen, TheirPcs::Bishop) &
-    *Attacks::BAttacks[king_square(Us)];
-
-  uint64_t pinned_pcs = 0, b;
-
-  if (pinner) do {
-    b = Attacks::SqBetween[king_square(Us)][Bitboard::lsb(pinner)] & all_pieces();
-
-    if (!Bitboard::more_than_one(b))
-      pinned_pcs |= b & pieces(Us);
-  } while (pinner &= pinner - 1);
+  return slider_blockers(king_square(Us), ~Us) & pieces(Us);
+}
 
-  return pinned_pcs;
+// Returns true if the legal move m checks their king. A move checks
+// directly if the piece lands on a check square of its type, and by
+// discovery if a candidate leaves the line between our slider and their
+// king. Promotions, en passant and castling also move or remove a second
+// piece, so they are tested on the occupancy after the move
+bool Position::gives_check(Move::Type m) const
+{
+  using namespace Bitboard;
+  using namespace Piece;
+  const Square::Type From = Move::from_sq(m);
+  const Square::Type To = Move::to_sq(m);
+  const Color::Type Us = side_to_move();
+  const Square::Type Ksq = king_square(~Us);
+
+  if (bit_set(game_line->check_squares[piece_type(piece(From))], To))
+    return true;
+  if (bit_set(game_line->discoverers, From) && !bit_set(Attacks::LineBetween[From][Ksq], To))
+    return true;
+
+  switch (Move::flags(m)) {
+  case Move::Flags::PROMOTION: {
+    const uint64_t Occ = all_pieces() ^ sq_mask(From);
+    switch (Move::promotion_pc(m)) {
+    case KNIGHT: return bit_set(Attacks::KnightAttacks[To], Ksq);
+    case BISHOP: return bit_set(Attacks::slider_lookup<BISHOP>(To, Occ), Ksq);
+    case ROOK:   return bit_set(Attacks::slider_lookup<ROOK>(To, Occ), Ksq);
+    default:     return bit_set(Attacks::slider_lookup<QUEEN>(To, Occ), Ksq);
+    }
+  }
+  case Move::Flags::ENPASSANT: {
+    // The captured pawn may uncover a check too
+    const uint64_t Occ = all_pieces() ^ sq_mask(From, To, Square::south(To, Us));
+    return (Attacks::slider_lookup<BISHOP>(Ksq, Occ)
+      & pieces(make_piece(BISHOP, Us), make_piece(QUEEN, Us)))
+      || (Attacks::slider_lookup<ROOK>(Ksq, Occ)
+      & pieces(make_piece(ROOK, Us), make_piece(QUEEN, Us)));
+  }
+  case Move::Flags::CASTLING: {
+    // The rook gives the check, from the square the king passed over
+    const Square::Type RookTo = Square::Type((From + To) / 2);
+    const Square::Type RookFrom = To > From ? Square::Type(To + 1) : Square::Type(To - 2);
+    return bit_set(Attacks::slider_lookup<ROOK>(RookTo,
+      all_pieces() ^ sq_mask(From, To) ^ sq_mask(RookFrom, RookTo)), Ksq);
+  }
+  default:
+    return false;
+  }
 }
 
 void Position::make_move(Move::Type m, GameLine& gl)
 {
   assert(is_ok(m));
-  // Directly copy the current game line into new_line
-  std::memcpy(&gl, &game_line, sizeof(GameLine));
+  // Only the fields that carry over are copied, make_move() sets the rest
+  std::memcpy(&gl, game_line, offsetof(GameLine, captured_piece));
+  gl.previous = game_line;
+  game_line = &gl;
 
   const Square::Type From = Move::from_sq(m);
   const Square::Type To = Move::to_sq(m);
   const Move::Flags Flag = Move::flags(m);
-  const Piece::Type Pc = board[From];
+  const Piece::Type Pc = piece(From);
   const Piece::PieceType Pt = Piece::piece_type(Pc);
-  const Piece::Type Capture = board[To];
+  const Piece::Type Capture = piece(To);
   const Color::Type Us = Piece::color_of(Pc);
 
-  game_line.captured_piece = board[To];
+  game_line->captured_piece = piece(To);
   assert(side_to_move() == Us);
-  game_line.active_color = ~Us;
-  game_line.key ^= Zobrist::SideHash;
-  ++game_line.fifty_move;
+  game_line->active_color = ~Us;
+  game_line->key ^= Zobrist::SideHash;
+  ++game_line->fifty_move;
   ++game_ply;
 
-  if (game_line.ep_sq != Square::NONE)
-    game_line.key ^= Zobrist::EpHash[game_line.ep_sq];
+  if (game_line->ep_sq != Square::NONE)
+    game_line->key ^= Zobrist::EpHash[game_line->ep_sq];
 
-  game_line.ep_sq = Square::NONE; // reset enpassant capture square
+  game_line->ep_sq = Square::NONE; // reset enpassant capture square
 
   /*
   ** Now we'll 'apply' the move. Besides simply moving the piece, things to
@@ -214,14 +311,14 @@ void Position::make_move(Move::Type m, GameLine& gl)
   // Handle Castling rights. No matter which piece moves from squares
   // a1, h1, a8, h8, e1, and e8, we remove castling rights associated
   // with that square
-  game_line.key ^= Zobrist::CastlingHash[game_line.castle_rights];
-  game_line.castle_rights &= Castling::CastleRights[From];
-  game_line.castle_rights &= Castling::CastleRights[To];
-  game_line.key ^= Zobrist::CastlingHash[game_line.castle_rights];
+  game_line->key ^= Zobrist::CastlingHash[game_line->castle_rights];
+  game_line->castle_rights &= Castling::CastleRights[From];
+  game_line->castle_rights &= Castling::CastleRights[To];
+  game_line->key ^= Zobrist::CastlingHash[game_line->castle_rights];
 
   // 1. Handle captures
   if (Capture != Piece::NONE) // 1. (i) Remove the captured piece
-    remove_piece(Capture, To), game_line.fifty_move = 0;
+    remove_piece(Capture, To), game_line->fifty_move = 0;
   // En-Passant captures are handled later
 
   // Move the piece normally, except in case of promotion
@@ -231,19 +328,19 @@ void Position::make_move(Move::Type m, GameLine& gl)
     // 2. (ii) Handle Promotions
     remove_piece(Piece::make_piece(Piece::PAWN, Us), From);
     set_piece(Piece::make_piece(Move::promotion_pc(m), Us), To);
-    game_line.fifty_move = 0;
+    game_line->fifty_move = 0;
     goto end;
   }
 
   // 2. Handle Pawn moves
   if (Pt == Piece::PAWN) {
-    game_line.fifty_move = 0;
+    game_line->fifty_move = 0;
     // 2. (i) Handle en-passant
     if (Flag == Move::Flags::ENPASSANT)
       remove_piece(Piece::make_piece(Piece::PAWN, ~Us), Square::south(To, Us));
     else if ((From ^ To) == 16) { // 2. (iii) Set en-passant square
-      game_line.ep_sq = Square::Type((From + To) >> 1);
-      game_line.key ^= Zobrist::EpHash[ep_square()];
+      game_line->ep_sq = Square::Type((From + To) >> 1);
+      game_line->key ^= Zobrist::EpHash[ep_square()];
     }
   }
 
@@ -258,75 +355,101 @@ void Position::make_move(Move::Type m, GameLine& gl)
         move_piece(Piece::make_piece(Piece::ROOK, Us), From - 4, From - 1);  // Queen side castling
     }
     // Update the king squares
-    game_line.king_sq[Us] = To;
+    game_line->king_sq[Us] = To;
   }
 
 end:
-  if (Us == Color::WHITE) {
-    game_line.checking_pieces = attackers_to<Color::BLACK>(game_line.king_sq[Color::BLACK]);
-    game_line.pinned_pieces = pinned<Color::BLACK>();
-  } else {
-    game_line.checking_pieces = attackers_to<Color::WHITE>(game_line.king_sq[Color::WHITE]);
-    game_line.pinned_pieces = pinned<Color::WHITE>();
-  }
+  // A normal move checks from a check square, or by uncovering one of our
+  // sliders. The other moves move or remove a second piece, so their
+  // checkers are found from scratch
+  if (Flag == Move::Flags::NONE) {
+    using namespace Piece;
+    const Square::Type Ksq = game_line->king_sq[~Us];
+    const GameLine& Prev = *gl.previous;
+    uint64_t checkers = Bitboard::bit_set(Prev.check_squares[Pt], To) ? Bitboard::sq_mask(To) : 0;
+    if (Bitboard::bit_set(Prev.discoverers, From))
+      checkers |= (Attacks::slider_lookup<BISHOP>(Ksq, all_pieces())
+        & pieces(make_piece(BISHOP, Us), make_piece(QUEEN, Us)))
+        | (Attacks::slider_lookup<ROOK>(Ksq, all_pieces())
+        & pieces(make_piece(ROOK, Us), make_piece(QUEEN, Us)));
+    game_line->checking_pieces = checkers;
+  }
+  else if (Us == Color::WHITE)
+    game_line->checking_pieces = attackers_to<Color::BLACK>(game_line->king_sq[Color::BLACK]);
+  else
+    game_line->checking_pieces = attackers_to<Color::WHITE>(game_line->king_sq[Color::WHITE]);
+  game_line->pinned_pieces = PinsUnknown;
+  set_check_info();
   assert(is_ok());
 }
 
+// Make a move that won't be unmade, as in a game: the position keeps the
+// new game line in its root one, and no game line of the caller's
+void Position::make_move(Move::Type m)
+{
+  assert(game_line == &root_line);
+  GameLine gl;
+  make_move(m, gl);
+  root_line = gl;
+  root_line.previous = nullptr;
+  game_line = &root_line;
+}
+
+// Copy-make: returns the position after the legal move m, leaving this one
+// as it is, for workers that each take their own positions. The game line
+// of the move is made right in the root game line of the copy, so only the
+// board and the bitboards are copied besides it
+Position Position::copy_make(Move::Type m) const
+{
+  Position next;
+  std::memcpy(next.piece_BB, piece_BB, sizeof(piece_BB));
+  std::memcpy(next.color_BB, color_BB, sizeof(color_BB));
+  std::memcpy(next.board, board, sizeof(board));
+  next.game_ply = game_ply;
+  // make_move() only reads the game line it links to
+  next.game_line = game_line;
+  next.make_move(m, next.root_line);
+  next.root_line.previous = nullptr;
+  return next;
+}
+
 void Position::make_null_move(GameLine& gl) {
-  std::memcpy(&gl, &game_line, sizeof(GameLine));
+  std::memcpy(&gl, game_line, offsetof(GameLine, captured_piece));
+  gl.previous = game_line;
+  game_line = &gl;
+  game_line->captured_piece = Piece::NONE;
 
-  game_line.key ^= Zobrist::SideHash;
-  ++game_line.fifty_move;
+  game_line->key ^= Zobrist::SideHash;
+  ++game_line->fifty_move;
 
-  if (game_line.ep_sq != Square::NONE) {
-    game_line.key ^= Zobrist::EpHash[game_line.ep_sq];
-    game_line.ep_sq = Square::NONE;
+  if (game_line->ep_sq != Square::NONE) {
+    game_line->key ^= Zobrist::EpHash[game_line->ep_sq];
+    game_line->ep_sq = Square::NONE;
   }
 
-  if (game_line.active_color == Color::WHITE) {
-    game_line.checking_pieces = attackers_to<Color::BLACK>(game_line.king_sq[Color::BLACK]);
-    game_line.pinned_pieces = pinned<Color::BLACK>();
-  }
-  else {
-    game_line.checking_pieces = attackers_to<Color::WHITE>(game_line.king_sq[Color::WHITE]);
-    game_line.pinned_pieces = pinned<Color::WHITE>();
-  }
+  if (game_line->active_color == Color::WHITE)
+    game_line->checking_pieces = attackers_to<Color::BLACK>(game_line->king_sq[Color::BLACK]);
+  else
+    game_line->checking_pieces = attackers_to<Color::WHITE>(game_line->king_sq[Color::WHITE]);
+  game_line->pinned_pieces = PinsUnknown;
 
-  game_line.active_color = ~game_line.active_color;
+  game_line->active_color = ~game_line->active_color;
+  set_check_info();
 
   assert(is_ok());
 }
 
-void Position::make_see_move(Color::Type us, Move::Type m, Piece::Type* cap)
-{
-  assert(!Move::is_move(m, Move::Flags::CASTLING));
-  assert(!Move::is_move(m, Move::Flags::PROMOTION));
-  
-  Square::Type from_sq = Move::from_sq(m), to_sq = Move::to_sq(m);
-  *cap = board[to_sq];
-
-  if (Move::is_move(m, Move::Flags::ENPASSANT)) {
-    assert(Piece::piece_type(board[to_sq - Square::south(to_sq, us)]) == Piece::PAWN);
-    remove_piece<false>(Piece::make_piece(Piece::PAWN, us), Square::south(to_sq, us));
-  }
-  else {
-    assert(*cap != Piece::NONE);
-    remove_piece<false>(board[to_sq], to_sq);
-  }
-
-  move_piece<false>(board[from_sq], from_sq, to_sq);
-}
-
 void Position::unmake_move(Move::Type m, const GameLine& gl)
 {
+  assert(game_line == &gl);
   const Square::Type To = Move::to_sq(m);
   const Square::Type From = Move::from_sq(m);
-  const Piece::Type Pc = board[To];
+  const Piece::Type Pc = piece(To);
   const Color::Type Us = Piece::color_of(Pc);
   assert(side_to_move() != Us);
   const Move::Flags Flag = Move::flags(m);
 
-  assert(board[From] == Piece::NONE);
+  assert(piece(From) == Piece::NONE);
 
   if (Flag != Move::Flags::PROMOTION)
     move_piece<false>(Pc, To, From);
@@ -336,8 +459,8 @@ void Position::unmake_move(Move::Type m, const GameLine& gl)
   }
 
   // Handle captures
-  if (game_line.captured_piece != Piece::NONE)
-    set_piece<false>(game_line.captured_piece, To);
+  if (game_line->captured_piece != Piece::NONE)
+    set_piece<false>(game_line->captured_piece, To);
 
   // Handle en-passant
   if (Flag == Move::Flags::ENPASSANT)
@@ -351,117 +474,74 @@ void Position::unmake_move(Move::Type m, const GameLine& gl)
       move_piece<false>(Piece::make_piece(Piece::ROOK, Us), From - 1, From - 4);
   }
 
-  // Directly copy the game line
-  std::memcpy(&game_line, &gl, sizeof(GameLine));
+  // Go back to the game line before the move
+  game_line = gl.previous;
   --game_ply;
   assert(is_ok());
 }
 
 void Position::unmake_null_move(const GameLine& gl) {
+  assert(game_line == &gl);
+  game_line = gl.previous;
   assert(!checkers());
-  std::memcpy(&game_line, &gl, sizeof(GameLine));
   assert(is_ok());
 }
 
-inline void Position::unmake_see_move(Color::Type us, Move::Type m, Piece::Type cap)
+// Static exchange evaluation of move m for 'us': the material won once all
+// the captures on its destination square are played out, each side
+// capturing with its least valuable piece and free to stop. Pins are
+// ignored, and the king only captures on an undefended square
+int Position::see(Color::Type us, Move::Type m) const
 {
-  Square::Type from_sq = Move::from_sq(m), to_sq = Move::to_sq(m);
-  assert(board[from_sq] == Piece::NONE);
-
-  move_piece<false>(board[to_sq], to_sq, from_sq);
-
-  if (cap != Piece::NONE)
-    set_piece<false>(cap, to_sq);
-
-  if (Move::is_move(m, Move::Flags::ENPASSANT))
-    set_piece<false>(Piece::make_piece(Piece::PAWN, ~us), Square::south(to_sq, us));
-}
-
-int Position::see(Color::Type us, Move::Type m)
-{
-  Color::Type stm = ~us;
+  using namespace Attacks;
+  const Square::Type From = Move::from_sq(m), To = Move::to_sq(m);
   int gain[32], d = 0;
-  Square::Type to_sq = Move::to_sq(m), from_sq = Move::from_sq(m);
+  uint64_t occupied = all_pieces() ^ Bitboard::sq_mask(From);
 
-  Piece::Type captured;
-  make_see_move(us, m, &captured);
-
-  uint64_t occupied = all_pieces() ^ Bitboard::sq_mask(from_sq), attack;
-
-  if (Move::is_move(m, Move::Flags::ENPASSANT)) {
+  // Value of the piece standing on 'To', the next one to be captured
+  int on_square = Scores::PieceVal[Piece::piece_type(piece(From))].mg;
+  if (Move::flags(m) == Move::Flags::ENPASSANT) {
     gain[0] = Scores::PawnValue.mg;
-    occupied ^= Bitboard::sq_mask(Square::south(to_sq, us));
-  }
-  else {
-    Piece::PieceType pt = Piece::piece_type(board[to_sq]);
-    if (pt == Piece::KING)
-      return Score::MATE_SCORE;
-
-    gain[0] = Scores::PieceVal[pt].mg;
-  }
-
-  while (true) {
-    d++;
-    int best = Score::MATE_SCORE;
-    Piece::Type p = Piece::make_piece(Piece::PAWN, stm);
-
-    attack = Attacks::PawnAttacks[~stm][to_sq] & piece_BB[p] & occupied;
-    if (attack)
-      best = Scores::PawnValue.mg;
-    else {
-      p = Piece::make_piece(Piece::KNIGHT, stm);
-      attack = Attacks::KnightAttacks[to_sq] & piece_BB[p] & occupied;
-
-      if (attack)
-        best = Scores::KnightValue.mg;
-      else {
-        p = Piece::make_piece(Piece::BISHOP, stm);
-        attack = Attacks::slider_attacks<Piece::BISHOP>(to_sq, occupied);
-        attack &= piece_BB[p];
-
-        if (attack)
-          best = Scores::BishopValue.mg;
-        else {
-          p = Piece::make_piece(Piece::ROOK, stm);
-          attack = Attacks::slider_attacks<Piece::ROOK>(to_sq, occupied);
-          attack &= piece_BB[p];
-
-          if (attack)
-            best = Scores::RookValue.mg;
-          else {
-            p = Piece::make_piece(Piece::QUEEN, stm);
-            attack = Attacks::slider_attacks<Piece::QUEEN>(to_sq, occupied);
-            attack &= piece_BB[p];
-
-            if (attack)
-              best = Scores::QueenValue.mg;
-
-            else {
-              p = Piece::make_piece(Piece::KING, stm);
-              attack = Attacks::KingAttacks[to_sq] & piece_BB[p];
-
-              if (attack)
-                best = Score::MATE_SCORE;
-              else
-                break;
-            }
-          }
-        }
-      }
-    }
+    occupied ^= Bitboard::sq_mask(Square::south(To, us));
+  }
+  else
+    gain[0] = piece(To) == Piece::NONE ? 0 : Scores::PieceVal[Piece::piece_type(piece(To))].mg;
+  if (Move::flags(m) == Move::Flags::PROMOTION) {
+    on_square = Scores::PieceVal[Move::promotion_pc(m)].mg;
+    gain[0] += on_square - Scores::PawnValue.mg;
+  }
+
+  // The least valuable piece of color c attacking 'To', and its type
+  auto least_attacker = [&](Color::Type c, Piece::PieceType& pt) -> uint64_t {
+    using namespace Piece;
+    uint64_t b;
+    if ((b = PawnAttacks[~c][To] & piece_BB[make_piece(PAWN, c)] & occupied)) pt = PAWN;
+    else if ((b = KnightAttacks[To] & piece_BB[make_piece(KNIGHT, c)] & occupied)) pt = KNIGHT;
+    else if ((b = slider_lookup<BISHOP>(To, occupied) & piece_BB[make_piece(BISHOP, c)] & occupied)) pt = BISHOP;
+    else if ((b = slider_lookup<ROOK>(To, occupied) & piece_BB[make_piece(ROOK, c)] & occupied)) pt = ROOK;
+    else if ((b = slider_lookup<QUEEN>(To, occupied) & piece_BB[make_piece(QUEEN, c)] & occupied)) pt = QUEEN;
+    else if ((b = KingAttacks[To] & piece_BB[make_piece(KING, c)] & occupied)) pt = KING;
+    return b & (0 - b);
+  };
 
-    gain[d] = best - gain[d - 1];
-    if (best = Score::MATE_SCORE)
+  Color::Type stm = ~us;
+  Piece::PieceType pt, unused;
+  uint64_t attacker;
+  while ((attacker = least_attacker(stm, pt)) != 0) {
+    occupied ^= attacker;
+    if ((pt == Piece::KING) && least_attacker(~stm, unused))
       break;
-
-    occupied &= ~(attack & -attack);
+    ++d;
+    gain[d] = on_square - gain[d - 1];
+    on_square = Scores::PieceVal[pt].mg;
     stm = ~stm;
   }
 
-  unmake_see_move(us, m, captured);
-
-  while (--d)
+  // Either side may stop capturing when going on would lose material
+  while (d) {
     gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+    --d;
+  }
 
   return gain[0];
 }
@@ -487,8 +567,8 @@ bool Position::is_ok() const
     while (b) {
       sq = Bitboard::pop_1st_bit(&b);
       key_ ^= Zobrist::PieceHash[pc][sq];
-      if (board[sq] != pc) {
-        cerr << "board[" << Square::to_str(sq) << "] = " << Piece::to_str(board[sq]) << endl;
+      if (piece(sq) != pc) {
+        cerr << "board[" << Square::to_str(sq) << "] = " << Piece::to_str(piece(sq)) << endl;
         cerr << "Bitboards claim it to be: " << Piece::to_str(pc) << endl;
         return false;
       }
@@ -502,95 +582,183 @@ bool Position::is_ok() const
     cerr << "Black has more than one king" << endl;
     return false;
   }
-  if (Bitboard::lsb(piece_BB[Piece::WHITE_KING]) != game_line.king_sq[Color::WHITE]) {
-    cerr << "Incorrect White king square: " << Square::to_str(game_line.king_sq[Color::WHITE]) << endl;
+  if (Bitboard::lsb(piece_BB[Piece::WHITE_KING]) != game_line->king_sq[Color::WHITE]) {
+    cerr << "Incorrect White king square: " << Square::to_str(game_line->king_sq[Color::WHITE]) << endl;
     cerr << "Bitboards claim it to be: " << Square::to_str(Bitboard::lsb(piece_BB[Piece::WHITE_KING])) << endl;
     return false;
   }
-  if (Bitboard::lsb(piece_BB[Piece::BLACK_KING]) != game_line.king_sq[Color::BLACK]) {
-    cerr << "Incorrect Black king square: " << Square::to_str(game_line.king_sq[Color::BLACK]) << endl;
+  if (Bitboard::lsb(piece_BB[Piece::BLACK_KING]) != game_line->king_sq[Color::BLACK]) {
+    cerr << "Incorrect Black king square: " << Square::to_str(game_line->king_sq[Color::BLACK]) << endl;
     cerr << "Bitboards claim it to be: " << Square::to_str(Bitboard::lsb(piece_BB[Piece::BLACK_KING])) << endl;
     return false;
   }
-  if (game_line.castle_rights >= Castling::CASTLING_RIGHT_NB) {
+  if (game_line->castle_rights >= Castling::CASTLING_RIGHT_NB) {
     cerr << "Incorrect Castling Rights" << endl;
     return false;
   }
-  if (game_line.ep_sq >= Square::SQ_NB) {
+  if (game_line->ep_sq >= Square::SQ_NB) {
     cerr << "Incorrect En Passant Square" << endl;
     return false;
   }
-  key_ ^= Zobrist::CastlingHash[game_line.castle_rights];
+  key_ ^= Zobrist::CastlingHash[game_line->castle_rights];
   if (side_to_move() == Color::BLACK)
     key_ ^= Zobrist::SideHash;
   if (ep_square() != Square::NONE)
     key_ ^= Zobrist::EpHash[ep_square()];
-  if (key_ != game_line.key) {
-    cerr << "Incorrect Key: " << Misc::hash << game_line.key << endl;
+  if (key_ != game_line->key) {
+    cerr << "Incorrect Key: " << Misc::hash << game_line->key << endl;
     cerr << "Should be:     " << Misc::hash << key_ << Misc::unhash << endl;
     return false;
   }
-  if (pinned() != (side_to_move() == Color::WHITE ? pinned<Color::WHITE>() : pinned<Color::BLACK>())) {
+  if ((game_line->pinned_pieces != PinsUnknown)
+    && (pinned() != (side_to_move() == Color::WHITE ? pinned<Color::WHITE>() : pinned<Color::BLACK>()))) {
     cerr << "Pinned pieces not updated correctly" << endl;
     cerr << "Currently are:\n" << Bitboard::to_str(pinned()) << "but should be:\n"
       << Bitboard::to_str(side_to_move() == Color::WHITE ? pinned<Color::WHITE>() : pinned<Color::BLACK>());
     cerr << " position: " << to_fen() << endl;
     return false;
   }
+  if (checkers() != (side_to_move() == Color::WHITE ? attackers_to<Color::WHITE>(king_square(Color::WHITE))
+    : attackers_to<Color::BLACK>(king_square(Color::BLACK)))) {
+    cerr << "Checking pieces not updated correctly" << endl;
+    cerr << " position: " << to_fen() << endl;
+    return false;
+  }
   return true;
 }
 
-bool Position::is_ok(Move::Type m) const
+// Test if m is a legal move in this position. Nothing is assumed about m,
+// so that moves from the transposition table or the killers of another
+// node can be tried before any move is generated. With 'verbose' set, the
+// reason a move is rejected is printed
+bool Position::is_ok(Move::Type m, bool verbose) const
 {
+  using namespace Attacks;
   const Color::Type Us = side_to_move();
   const Square::Type From = Move::from_sq(m);
   const Square::Type To = Move::to_sq(m);
   const Move::Flags Flag = Move::flags(m);
-  const Piece::Type Pc = board[From];
-  const Piece::PieceType Pt = Piece::piece_type(Pc);
-  const Piece::Type Capture = board[To];
+  const Piece::Type Pc = piece(From);
+  const Piece::Type Capture = piece(To);
   const Color::Type Them = ~Us;
+  const Square::Type Ksq = king_square(Us);
 
   using namespace std;
-  if (From == To) {
-    cerr << "From and To squares of the move: " << Move::to_str(m) << " are equal.";
+  auto reject = [verbose](const char* reason) {
+    if (verbose) cerr << reason;
     return false;
-  }
-  if (Piece::color_of(Pc) != Us) {
-    cerr << "Color of moving piece isn't the color to move.";
+  };
+
+  if (From == To) {
+    if (verbose) cerr << "From and To squares of the move: " << Move::to_str(m) << " are equal.";
     return false;
   }
+  if ((Flag != Move::Flags::PROMOTION) && (int(m) >> 14))
+    return reject("Only promotions have a promotion piece.");
+  if (Pc == Piece::NONE)
+    return reject("There is no piece to move.");
+  if (Piece::color_of(Pc) != Us)
+    return reject("Color of moving piece isn't the color to move.");
+  const Piece::PieceType Pt = Piece::piece_type(Pc);
   if (Capture != Piece::NONE) {
-    if (Piece::color_of(Capture) != Them) {
-      cerr << "Color of captured piece should be the opposite color.";
-      return false;
-    }
-    if (Piece::piece_type(Capture) == Piece::KING) {
-      cerr << "King can not be captured!";
-      return false;
-    }
-    if (Flag == Move::Flags::CASTLING) {
-      cerr << "Castling shouldn't be involved in a capture.";
-      return false;
-    }
+    if (Piece::color_of(Capture) != Them)
+      return reject("Color of captured piece should be the opposite color.");
+    if (Piece::piece_type(Capture) == Piece::KING)
+      return reject("King can not be captured!");
+    if (Flag == Move::Flags::CASTLING)
+      return reject("Castling shouldn't be involved in a capture.");
   }
+
+  // Can the piece make this move?
   if (Pt == Piece::PAWN) {
-    // En-passant
+    const bool LastRank = Square::rank_of(To) == (Us == Color::WHITE ? Square::RANK_8 : Square::RANK_1);
+    if (LastRank != (Flag == Move::Flags::PROMOTION))
+      return reject("A pawn promotes if and only if it reaches the last rank.");
+    if (Flag == Move::Flags::CASTLING)
+      return reject("A pawn can't castle.");
     if (Flag == Move::Flags::ENPASSANT) {
-      if (Pt != Piece::PAWN) {
-        cerr << "Moving piece must be a pawn during an En-passant capture";
-        return false;
-      }
-      if (board[To] != Piece::NONE) {
-        cerr << "Pawn must move to an empty square after an En-passant capture";
-        return false;
-      }
-      if (board[To + ((Us << 4) - 8)] != Piece::make_piece(Piece::PAWN, Them)) {
-        cerr << "Captured piece must be pawn in an En-Passant capture.";
-        return false;
-      }
+      if (To != ep_square())
+        return reject("En-passant capture must be to the En-passant square.");
+      if (piece(To) != Piece::NONE)
+        return reject("Pawn must move to an empty square after an En-passant capture");
+      if (piece(Square::south(To, Us)) != Piece::make_piece(Piece::PAWN, Them))
+        return reject("Captured piece must be pawn in an En-Passant capture.");
+    }
+    if ((Flag == Move::Flags::ENPASSANT) || (Capture != Piece::NONE)) {
+      if (!Bitboard::bit_set(PawnAttacks[Us][From], To))
+        return reject("Pawn can't capture on this square.");
     }
+    else if (Square::south(To, Us) != From) {
+      // Only a double push from the second rank is left
+      const Square::Type Mid = Square::south(To, Us);
+      if ((Square::south(Mid, Us) != From) || (piece(Mid) != Piece::NONE)
+        || (Square::rank_of(From) != (Us == Color::WHITE ? Square::RANK_2 : Square::RANK_7)))
+        return reject("Invalid pawn push.");
+    }
+  }
+  else if (Flag == Move::Flags::CASTLING) {
+    if (Pt != Piece::KING)
+      return reject("Only the king castles.");
+    if (checkers())
+      return reject("Can't castle out of check.");
+    const bool OO = Us == Color::WHITE ? can_castle_OO<Color::WHITE>() : can_castle_OO<Color::BLACK>();
+    const bool OOO = Us == Color::WHITE ? can_castle_OOO<Color::WHITE>() : can_castle_OOO<Color::BLACK>();
+    const Square::Type OOTo = Us == Color::WHITE ? Square::G1 : Square::G8;
+    const Square::Type OOOTo = Us == Color::WHITE ? Square::C1 : Square::C8;
+    if (!((OO && (To == OOTo)) || (OOO && (To == OOOTo))))
+      return reject("Castling isn't possible.");
+    return true;
   }
+  else {
+    if (Flag != Move::Flags::NONE)
+      return reject("Only pawns make En-passant captures and promotions.");
+    uint64_t attacks;
+    switch (Pt) {
+    case Piece::KNIGHT: attacks = KnightAttacks[From]; break;
+    case Piece::BISHOP: attacks = slider_lookup<Piece::BISHOP>(From, all_pieces()); break;
+    case Piece::ROOK:   attacks = slider_lookup<Piece::ROOK>(From, all_pieces()); break;
+    case Piece::QUEEN:  attacks = slider_lookup<Piece::QUEEN>(From, all_pieces()); break;
+    default:            attacks = KingAttacks[From]; break;
+    }
+    if (!Bitboard::bit_set(attacks, To))
+      return reject("The piece can't move to this square.");
+  }
+
+  // Does the move leave our king in check?
+  const uint64_t TheirDiagonals = Us == Color::WHITE ? pieces(Piece::BLACK_BISHOP, Piece::BLACK_QUEEN)
+    : pieces(Piece::WHITE_BISHOP, Piece::WHITE_QUEEN);
+  const uint64_t TheirOrthogonals = Us == Color::WHITE ? pieces(Piece::BLACK_ROOK, Piece::BLACK_QUEEN)
+    : pieces(Piece::WHITE_ROOK, Piece::WHITE_QUEEN);
+  if (Pt == Piece::KING) {
+    // The king can't hide behind itself from a slider
+    const uint64_t Occupied = all_pieces() ^ Bitboard::sq_mask(From);
+    if ((PawnAttacks[Us][To] & pieces(Piece::make_piece(Piece::PAWN, Them)))
+      || (KnightAttacks[To] & pieces(Piece::make_piece(Piece::KNIGHT, Them)))
+      || (KingAttacks[To] & pieces(Piece::make_piece(Piece::KING, Them)))
+      || (slider_lookup<Piece::BISHOP>(To, Occupied) & TheirDiagonals)
+      || (slider_lookup<Piece::ROOK>(To, Occupied) & TheirOrthogonals))
+      return reject("The king moves into check.");
+    return true;
+  }
+  if (Bitboard::more_than_one(checkers()))
+    return reject("Only the king can move in a double check.");
+  if (checkers()) {
+    const Square::Type Checker = Bitboard::lsb(checkers());
+    const bool CapturesChecker = (To == Checker)
+      || ((Flag == Move::Flags::ENPASSANT) && (Square::south(To, Us) == Checker));
+    if (!CapturesChecker && !Bitboard::bit_set(SqBetween[Ksq][Checker], To))
+      return reject("The move doesn't get out of check.");
+  }
+  if (Flag == Move::Flags::ENPASSANT) {
+    // Two pawns leave the rank of the king at once
+    const uint64_t Occupied = (all_pieces() ^ Bitboard::sq_mask(From, Square::south(To, Us)))
+      | Bitboard::sq_mask(To);
+    if ((slider_lookup<Piece::BISHOP>(Ksq, Occupied) & TheirDiagonals)
+      || (slider_lookup<Piece::ROOK>(Ksq, Occupied) & TheirOrthogonals))
+      return reject("The En-passant capture leaves the king in check.");
+  }
+  else if (Bitboard::bit_set(pinned(), From) && !Bitboard::bit_set(LineBetween[From][Ksq], To))
+    return reject("A pinned piece leaves the line of its king.");
   return true;
 }
 
@@ -600,32 +768,81 @@ Position Position::flip()
   out.reset();
 
   for (Square::Type sq = Square::A1; sq < Square::SQ_NB; ++sq)
-    if (board[sq] != Piece::NONE)
-      out.set_piece(~board[sq], Square::flip(sq));
+    if (piece(sq) != Piece::NONE)
+      out.set_piece(~piece(sq), Square::flip(sq));
 
-  out.game_line.active_color = ~side_to_move();
-  if (out.game_line.active_color == Color::BLACK)
-    out.game_line.key ^= Zobrist::SideHash;
+  out.game_line->active_color = ~side_to_move();
+  if (out.game_line->active_color == Color::BLACK)
+    out.game_line->key ^= Zobrist::SideHash;
 
   if (castling_rights() & Castling::WHITE_OO)
-    out.game_line.castle_rights |= Castling::BLACK_OO;
+    out.game_line->castle_rights |= Castling::BLACK_OO;
 
   if (castling_rights() & Castling::WHITE_OOO)
-    out.game_line.castle_rights |= Castling::BLACK_OOO;
+    out.game_line->castle_rights |= Castling::BLACK_OOO;
 
   if (castling_rights() & Castling::BLACK_OO)
-    out.game_line.castle_rights |= Castling::WHITE_OO;
+    out.game_line->castle_rights |= Castling::WHITE_OO;
 
   if (castling_rights() & Castling::BLACK_OOO)
-    out.game_line.castle_rights |= Castling::WHITE_OOO;
-  out.game_line.key ^= Zobrist::CastlingHash[out.game_line.castle_rights];
+    out.game_line->castle_rights |= Castling::WHITE_OOO;
+  out.game_line->key ^= Zobrist::CastlingHash[out.game_line->castle_rights];
 
   if (ep_square() != Square::NONE) {
-    out.game_line.ep_sq = Square::flip(ep_square());
-      out.game_line.key ^= Zobrist::EpHash[Square::flip(ep_square())];
+    out.game_line->ep_sq = Square::flip(ep_square());
+      out.game_line->key ^= Zobrist::EpHash[Square::flip(ep_square())];
   }
 
   out.update();
   assert(out.is_ok());
   return out;
 }
+
+// The smallest of the Zobrist keys of this position and the positions
+// symmetric to it: the color flip and, if nobody may castle, the left-right
+// mirror and the mirrored color flip. Symmetric positions have the same
+// perft counts. All four keys are computed from scratch the same way, so
+// that a position and its flip give the same result
+key_t Position::canonical_key() const
+{
+  const bool Mirror = castling_rights() == Castling::NONE;
+  // Identity, color flip, mirror, mirrored color flip
+  key_t key[4] = { 0, 0, 0, 0 };
+
+  uint64_t occupied = all_pieces();
+  while (occupied) {
+    const Square::Type Sq = Bitboard::lsb(occupied);
+    const Piece::Type Pc = piece(Sq);
+    key[0] ^= Zobrist::PieceHash[Pc][Sq];
+    key[1] ^= Zobrist::PieceHash[~Pc][Square::flip(Sq)];
+    if (Mirror) {
+      key[2] ^= Zobrist::PieceHash[Pc][Sq ^ 7];
+      key[3] ^= Zobrist::PieceHash[~Pc][Square::flip(Sq) ^ 7];
+    }
+    occupied &= occupied - 1;
+  }
+
+  if (side_to_move() == Color::BLACK)
+    key[0] ^= Zobrist::SideHash, key[2] ^= Zobrist::SideHash;
+  else
+    key[1] ^= Zobrist::SideHash, key[3] ^= Zobrist::SideHash;
+
+  const Castling::Right Cr = castling_rights();
+  key[0] ^= Zobrist::CastlingHash[Cr];
+  key[1] ^= Zobrist::CastlingHash[((Cr & Castling::WHITE_BOTH) << 2) | (Cr >> 2)];
+  key[2] ^= Zobrist::CastlingHash[Castling::NONE];
+  key[3] ^= Zobrist::CastlingHash[Castling::NONE];
+
+  // The en passant square maps like the pawns around it
+  if (ep_square() != Square::NONE) {
+    key[0] ^= Zobrist::EpHash[ep_square()];
+    key[1] ^= Zobrist::EpHash[Square::flip(ep_square())];
+    key[2] ^= Zobrist::EpHash[ep_square() ^ 7];
+    key[3] ^= Zobrist::EpHash[Square::flip(ep_square()) ^ 7];
+  }
+
+  key_t min_key = std::min(key[0], key[1]);
+  if (Mirror)
+    min_key = std::min(min_key, std::min(key[2], key[3]));
+  return min_key;
+}
@@ -4,38 +4,62 @@
 #include "bitboard.h"
 #include "zobrist.h"
 #include "attacks.h"
+#include "pext.h"
+#include "setwise.h"
 #include "score.h"
 #include <string>
 
+// The state of a position that can't be recovered when a move is unmade.
+// The game lines of the moves made form a stack, each linking to the one
+// before it: make_move() fills the caller's game line and makes it the
+// current one, and unmake_move() just goes back to the previous one
 struct GameLine {
+  // Carried over to the next game line by make_move()
   Color::Type active_color;
   Castling::Right castle_rights;
   Square::Type ep_sq; // En passant squares
   int fifty_move;
-  Piece::Type captured_piece;
   Square::Type king_sq[Color::COLOR_NB];
   key_t key;
 
+  // Set by make_move()
+  Piece::Type captured_piece;
   uint64_t checking_pieces;
-  uint64_t pinned_pieces;
+  uint64_t pinned_pieces; // PinsUnknown until pinned() is first called
+
+  // For the side to move: the squares from which a piece of each type
+  // would check their king, and our pieces whose move may uncover a check
+  uint64_t check_squares[Piece::PIECE_TYPE_NB];
+  uint64_t discoverers;
+
+  GameLine* previous;
 };
 
 class Position {
-  Piece::Type board[Square::SQ_NB];
-  uint64_t piece_BB[Piece::PIECE_NB];
+  // No position has all squares pinned
+  static const uint64_t PinsUnknown = Bitboard::Universe;
+
+  // The bitboards fill the first two cache lines and the board, a byte a
+  // square, the third, so that a copy of the position stays small
+  alignas(64) uint64_t piece_BB[Piece::PIECE_NB];
   uint64_t color_BB[Color::COLOR_NB];
-  GameLine game_line;
+  alignas(64) int8_t board[Square::SQ_NB];
+  GameLine* game_line;
   int game_ply;
+  GameLine root_line; // The game line of the position set up, or copied
 public:
-  Position() {};
+  Position() : game_line(&root_line) {};
+  Position(const Position& pos);
   ~Position() {};
+  Position& operator=(const Position& pos);
   void handle_error(const char * str);
   void parse_fen(const std::string &fen);
   std::string to_fen() const;
   std::string to_str() const;
   bool is_ok() const;
-  bool is_ok(Move::Type m) const;
+  bool is_ok(Move::Type m, bool verbose = true) const;
   Position flip();
+  key_t canonical_key() const;
 
   // Getters
   inline Square::Type ep_square() const;
@@ -54,23 +78,27 @@ public:
   inline uint64_t all_pieces() const;
   template <Piece::PieceType Pt> inline uint64_t attacks_by(Square::Type sq) const;
   void make_move(Move::Type m, GameLine& gl);
+  void make_move(Move::Type m);
+  Position copy_make(Move::Type m) const;
   void make_null_move(GameLine& gl);
-  void make_see_move(Color::Type us, Move::Type m, Piece::Type* cap);
   void unmake_move(Move::Type m, const GameLine& gl);
   void unmake_null_move(const GameLine& gl);
-  void unmake_see_move(Color::Type us, Move::Type m, Piece::Type cap);
   template <Color::Type Us> inline bool is_attacked(Square::Type sq) const;
   template <Color::Type Us> inline uint64_t attackers_to(Square::Type sq) const;
+  template <Color::Type Us> inline uint64_t attacked_squares(uint64_t occ) const;
   template <Color::Type Us> uint64_t pinned() const;
+  bool gives_check(Move::Type m) const;
   template <Color::Type Us> inline bool can_castle_OO() const;
   template <Color::Type Us> inline bool can_castle_OOO() const;
   inline key_t hash() const;
 
   // Static Exchange evaluation for a move
-  int see(Color::Type us, Move::Type m);
+  int see(Color::Type us, Move::Type m) const;
 private:
   void reset();
   void update();
+  uint64_t slider_blockers(Square::Type sq, Color::Type c) const;
+  void set_check_info();
 
   // Manipulation of board
   template <bool UpdateGameLine = true>
@@ -83,37 +111,42 @@ private:
 
 inline Square::Type Position::ep_square() const
 {
-  return game_line.ep_sq;
+  return game_line->ep_sq;
 }
 
 inline Castling::Right Position::castling_rights() const
 {
-  return game_line.castle_rights;
+  return game_line->castle_rights;
 }
 
 inline uint64_t Position::checkers() const
 {
-  return game_line.checking_pieces;
+  return game_line->checking_pieces;
 }
 
 inline Color::Type Position::side_to_move() const
 {
-  return game_line.active_color;
+  return game_line->active_color;
 }
 
+// The pins are only found when first asked for, as many positions are
+// left before any move is generated in them
 inline uint64_t Position::pinned() const
 {
-  return game_line.pinned_pieces;
+  if (game_line->pinned_pieces == PinsUnknown)
+    game_line->pinned_pieces = slider_blockers(king_square(side_to_move()),
+      ~side_to_move()) & pieces(side_to_move());
+  return game_line->pinned_pieces;
 }
 
 inline int Position::half_move() const
 {
-  return game_line.fifty_move;
+  return game_line->fifty_move;
 }
 
 inline Square::Type Position::king_square(Color::Type c) const
 {
-  return game_line.king_sq[c];
+  return game_line->king_sq[c];
 }
 
 inline uint64_t Position::pawns(Color::Type Us) const
@@ -123,7 +156,7 @@ inline uint64_t Position::pawns(Color::Type Us) const
 
 inline Piece::Type Position::piece(Square::Type sq) const
 {
-  return board[sq];
+  return Piece::Type(board[sq]);
 }
 
 inline uint64_t Position::pieces(Piece::Type pc) const
@@ -151,12 +184,12 @@ template <Piece::PieceType Pt>
 inline uint64_t Position::attacks_by(Square::Type sq) const
 {
   if (Pt == Piece::KNIGHT) return Attacks::KnightAttacks[sq];
-  else return Attacks::slider_attacks<Pt>(sq, all_pieces());
+  else return Attacks::slider_lookup<Pt>(sq, all_pieces());
 }
 
 inline key_t Position::hash() const
 {
-  return game_line.key;
+  return game_line->key;
 }
 
 template <bool UpdateGameLine>
@@ -164,7 +197,7 @@ inline void Position::set_piece(Piece::Type pc, Square::Type sq)
 {
   assert(pc < Piece::ALL_PIECES);
   assert(sq < Square::SQ_NB);
-  assert(board[sq] == Piece::NONE);
+  assert(piece(sq) == Piece::NONE);
   board[sq] = pc;
 
   assert(!Bitboard::bit_set(piece_BB[pc], sq));
@@ -177,14 +210,14 @@ inline void Position::set_piece(Piece::Type pc, Square::Type sq)
   color_BB[Piece::color_of(pc)] |= Bitboard::sq_mask(sq);
 
   if (UpdateGameLine)
-    game_line.key ^= Zobrist::PieceHash[pc][sq];
+    game_line->key ^= Zobrist::PieceHash[pc][sq];
 }
 
 template <bool UpdateGameLine>
 inline void Position::move_piece(Piece::Type pc, Square::Type from, Square::Type to)
 {
-  assert(board[from] == pc);
-  assert(board[to] == Piece::NONE);
+  assert(piece(from) == pc);
+  assert(piece(to) == Piece::NONE);
 
   board[from] = Piece::NONE;
   board[to] = pc;
@@ -200,13 +233,13 @@ inline void Position::move_piece(Piece::Type pc, Square::Type from, Square::Type
   color_BB[Piece::color_of(pc)] ^= FromToMask;
 
   if (UpdateGameLine)
-    game_line.key ^= Zobrist::hash(pc, from, to);
+    game_line->key ^= Zobrist::hash(pc, from, to);
 }
 
 template <bool UpdateGameLine>
 inline void Position::remove_piece(Piece::Type pc, Square::Type sq)
 {
-  assert(board[sq] == pc);
+  assert(piece(sq) == pc);
   board[sq] = Piece::NONE;
 
   assert(Bitboard::bit_set(piece_BB[pc], sq));
@@ -218,7 +251,7 @@ inline void Position::remove_piece(Piece::Type pc, Square::Type sq)
   assert(Bitboard::bit_set(color_BB[Piece::color_of(pc)], sq));
   color_BB[Piece::color_of(pc)] ^= Bitboard::sq_mask(sq);
   if (UpdateGameLine)
-    game_line.key ^= Zobrist::PieceHash[pc][sq];
+    game_line->key ^= Zobrist::PieceHash[pc][sq];
 }
 
 template <Color::Type Us>
@@ -228,9 +261,9 @@ bool Position::is_attacked(Square::Type sq) const
   using TheirPcs = Piece::PieceOfColor < Color::Type(!Us) > ;
   if (PawnAttacks[Us][sq] & pieces(TheirPcs::Pawn)) return true;
   if (KnightAttacks[sq] & pieces(TheirPcs::Knight)) return true;
-  if (slider_attacks<Piece::BISHOP>(sq, all_pieces()) &
+  if (slider_lookup<Piece::BISHOP>(sq, all_pieces()) &
       pieces(TheirPcs::Bishop, TheirPcs::Queen)) return true;
-  if (slider_attacks<Piece::ROOK>(sq, all_pieces()) &
+  if (slider_lookup<Piece::ROOK>(sq, all_pieces()) &
       pieces(TheirPcs::Rook, TheirPcs::Queen)) return true;
   if (KingAttacks[sq] & pieces(TheirPcs::King)) return true;
 
@@ -243,7 +276,7 @@ inline bool Position::can_castle_OO() const
   if (!Castling::can_castle_OO<Us>(castling_rights())) return false;
   assert(!is_attacked<Us>(Square::flip<Us>(Square::E1)));
   assert(king_square(Us) == Square::flip<Us>(Square::E1));
-  assert(Piece::piece_type(board[Square::flip<Us>(Square::H1)]) == Piece::ROOK);
+  assert(Piece::piece_type(piece(Square::flip<Us>(Square::H1))) == Piece::ROOK);
   if (all_pieces() & (0x60ULL << (56 * Us))) return false;
   if (is_attacked<Us>(Square::flip<Us>(Square::F1))) return false;
   if (is_attacked<Us>(Square::flip<Us>(Square::G1))) return false;
@@ -256,7 +289,7 @@ inline bool Position::can_castle_OOO() const
   if (!Castling::can_castle_OOO<Us>(castling_rights())) return false;
   assert(!is_attacked<Us>(Square::flip<Us>(Square::E1)));
   assert(king_square(Us) == Square::flip<Us>(Square::E1));
-  assert(Piece::piece_type(board[Square::flip<Us>(Square::A1)]) == Piece::ROOK);
+  assert(Piece::piece_type(piece(Square::flip<Us>(Square::A1))) == Piece::ROOK);
   if (all_pieces() & (0xEULL << (56 * Us))) return false;
   if (is_attacked<Us>(Square::flip<Us>(Square::D1))) return false;
   if (is_attacked<Us>(Square::flip<Us>(Square::C1))) return false;
@@ -271,11 +304,32 @@ uint64_t Position::attackers_to(Square::Type sq) const
   using TheirPcs = Piece::PieceOfColor < Color::Type(!Us) > ;
   return (PawnAttacks[Us][sq] & pieces(TheirPcs::Pawn)) |
     (KnightAttacks[sq] & pieces(TheirPcs::Knight)) |
-    (slider_attacks<Piece::BISHOP>(sq, all_pieces()) &
+    (slider_lookup<Piece::BISHOP>(sq, all_pieces()) &
     pieces(TheirPcs::Bishop, TheirPcs::Queen)) |
-    (slider_attacks<Piece::ROOK>(sq, all_pieces()) &
+    (slider_lookup<Piece::ROOK>(sq, all_pieces()) &
     pieces(TheirPcs::Rook, TheirPcs::Queen)) |
-    (KingAttacks[sq] & Bitboard::sq_mask(game_line.king_sq[!Us]));
+    (KingAttacks[sq] & Bitboard::sq_mask(game_line->king_sq[!Us]));
+}
+
+// Returns all squares attacked by the pieces that aren't of the given
+// color, with the pieces in 'occ' blocking their sliders. The sliders are
+// filled set-wise, so this is cheaper than attackers_to() for more than a
+// few squares
+template <Color::Type Us>
+uint64_t Position::attacked_squares(uint64_t occ) const
+{
+  using namespace Attacks;
+  using TheirPcs = Piece::PieceOfColor < Color::Type(!Us) > ;
+  const SliderAttacks Sliders = slider_attacks_setwise(pieces(TheirPcs::Rook, TheirPcs::Queen),
+    pieces(TheirPcs::Bishop, TheirPcs::Queen), occ);
+  uint64_t attacked = Sliders.orthogonal | Sliders.diagonal
+    | pawn_attacks<Color::Type(!Us)>(pieces(TheirPcs::Pawn))
+    | KingAttacks[game_line->king_sq[!Us]];
+  uint64_t knights = pieces(TheirPcs::Knight);
+  if (knights) do {
+    attacked |= KnightAttacks[Bitboard::lsb(knights)];
+  } while (knights &= knights - 1);
+  return attacked;
 }
 
 #endif
@@ -2,15 +2,10 @@
 #include <limits>
 
 namespace Random {
-  uint64_t s = 3141592653589793238ULL;
+  uint64_t s = Seed;
   uint64_t rand64()
   {
-    /*s ^= s >> 11;
-    s ^= s << 7;
-    s ^= s << 15;
-    s ^= s >> 18;*/
-    s ^= (s ^= (s ^= s >> 12) << 25) >> 27; /* xorshift64star */
-    return s * 0x2545F4914F6CDD1DULL;
+    return xorshift64star(s);
   }
 
   uint64_t rand64_few_bits()
@@ -3,6 +3,17 @@
 
 #include "yaka.h"
 namespace Random {
+  const uint64_t Seed = 3141592653589793238ULL;
+
+  // One step of the xorshift64* generator with state s
+  constexpr uint64_t xorshift64star(uint64_t& s)
+  {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545F4914F6CDD1DULL;
+  }
+
   extern uint64_t s;
   uint64_t rand64();
   uint64_t rand64_few_bits();
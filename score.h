@@ -7,11 +7,17 @@
 struct Score {
   enum {
     MIDGAME, ENDGAME, MG_BOUND = 75000, EG_BOUND = 19000, INTERPOL = MG_BOUND - EG_BOUND,
-    MATE_SCORE = 1 << 30, UNKNOWN_SCORE = MATE_SCORE + 3141, DRAW_SCORE = 0
+    // Evaluation terms are in millipawns, while the search works in
+    // centipawns. Evaluator::interpolate_score() converts between them
+    EVAL_GRAIN = 10,
+    // Search scores, mates included, must fit in 16 bits for the TT.
+    // Scores of MATE_BOUND and above are mates within MaxPly plies
+    MATE_SCORE = 32000, MATE_BOUND = MATE_SCORE - int(MaxPly),
+    UNKNOWN_SCORE = MATE_SCORE + 1, DRAW_SCORE = 0
   };
   
   static inline bool is_mate_score(int s) {
-    return s >= MATE_SCORE - 1000;
+    return s >= MATE_BOUND;
   }
 
   int mg, eg;
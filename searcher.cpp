@@ -48,10 +48,11 @@ uint64_t Searcher::search(depth_t depth, const HashList& hl) {
         timer.stop();
         uint64_t nps =  (nodes / (timer.get_elapsed_ms() / 1000.));
         os << "info depth " << d;
-        os << " score cp " << (int)(best_move.score / 10);
+        os << " score cp " << best_move.score;
         os << " nodes " << nodes;
         os << " nps " << nps;
         os << " tthits " << tthits;
+        os << " hashfull " << ttable.hashfull();
         os << " pv " << extract_pv(best_move.move) << std::endl;
         timer.start();
       }
@@ -72,41 +73,33 @@ int Searcher::alpha_beta(int alpha, int beta, depth_t depth, depth_t ply)
   if (alpha >= beta)
     return alpha;
 
-  TranspositionTable::Entry* ttentry; // Transposition table entry for this position
-  ttentry = ttable.probe(pos.hash());
+  TranspositionTable::Entry ttentry; // Transposition table entry for this position
+  const bool TTHit = ttable.probe(pos.hash(), ttentry);
 
-  if (ttentry != nullptr) {
-    if (ttentry->get_depth() >= depth) {
+  if (TTHit) {
+    if (ttentry.get_depth() >= depth) {
       ++tthits;
-      if (ttentry->get_type() == TTScoreType::ExactScore)
-        return ttentry->get_score(ply);
+      if (ttentry.get_type() == TTScoreType::ExactScore)
+        return ttentry.get_score(ply);
 
-      if ((ttentry->get_type() == TTScoreType::BetaBound)
-        && (ttentry->get_score(ply) >= beta))
-        return ttentry->get_score(ply);
+      if ((ttentry.get_type() == TTScoreType::BetaBound)
+        && (ttentry.get_score(ply) >= beta))
+        return ttentry.get_score(ply);
 
-      if ((ttentry->get_type() == TTScoreType::AlphaBound)
-        && (ttentry->get_score(ply) <= alpha))
-        return ttentry->get_score(ply);
+      if ((ttentry.get_type() == TTScoreType::AlphaBound)
+        && (ttentry.get_score(ply) <= alpha))
+        return ttentry.get_score(ply);
     }
   }
 
   if (is_draw(ply))
     return Score::DRAW_SCORE;
 
-  int eval = Score::UNKNOWN_SCORE, score;
-  if (ttentry != nullptr) {
-    if (ttentry->get_eval() != Score::UNKNOWN_SCORE)
-      eval = ttentry->get_eval();
-    else {
-      eval = Evaluator(pos).eval();
-      ttentry->set_eval(eval);
-    }
-  }
-  else {
-    eval = Evaluator(pos).eval();
-    ttable.record_eval(pos.hash(), eval);
-  }
+  int eval, score;
+  if (TTHit && (ttentry.get_eval() != Score::UNKNOWN_SCORE))
+    eval = ttentry.get_eval();
+  else
+    eval = evaluate();
 
   assert(eval != Score::UNKNOWN_SCORE);
 
@@ -124,12 +117,12 @@ int Searcher::alpha_beta(int alpha, int beta, depth_t depth, depth_t ply)
     // If this position was previously searched and the score was recorded
     // then we can use that score to determine whether a doing a null-move
     // would be worth it or not
-    if (ttentry != nullptr) {
-      assert(ttentry->get_type() != TTScoreType::EmptyScore);
+    if (TTHit) {
+      assert(ttentry.get_type() != TTScoreType::EmptyScore);
 
-      if ((ttentry->get_depth() >= (depth - NullMovePruningDepth))
-        && (ttentry->get_type() != TTScoreType::BetaBound)
-        && (ttentry->get_score(ply) < beta))
+      if ((ttentry.get_depth() >= (depth - NullMovePruningDepth))
+        && (ttentry.get_type() != TTScoreType::BetaBound)
+        && (ttentry.get_score(ply) < beta))
         do_null_move = false;
     }
     
@@ -169,38 +162,29 @@ int Searcher::alpha_beta(int alpha, int beta, depth_t depth, depth_t ply)
     }
   }
 
-  MoveGen movegen(pos);
-
-  // Test if the current position is checkmate or stalemate
-  if (movegen.size() == 0) {
-    if (pos.checkers()) // Oops... Checkmate
-      score = -(int)(Score::MATE_SCORE - (ply + 1));  // Checkmate score based on ply
-    else
-      score = Score::DRAW_SCORE; // Stalemate, draw
-
-    ttable.record(pos.hash(), depth, score, eval,
-      Move::Type::NONE, TTScoreType::ExactScore, ply);
-    return score;
-  }
-
-  // Test if the current position is draw by fifty-move rule
-  if (pos.half_move() >= 100)
+  // Test if the current position is draw by fifty-move rule, unless it's
+  // checkmate
+  if ((pos.half_move() >= 100) && (!pos.checkers() || MoveGen(pos, MoveGen::Evasions).size()))
     return Score::DRAW_SCORE; // Return stalemate score, aka contempt factor
 
   GameLine gl;
   bool pv_found = false;
-  Move::Type best_move, hash_move = Move::Type::NONE;
+  Move::Type best_move = Move::Type::NONE, hash_move = Move::Type::NONE;
 
-  if (ttentry != nullptr) {
-    if (ttentry->get_type() != TTScoreType::AlphaBound)
-      hash_move = ttentry->get_best_move();
+  if (TTHit) {
+    if (ttentry.get_type() != TTScoreType::AlphaBound)
+      hash_move = ttentry.get_best_move();
   }
 
-  ScoredMoveList smlist;
-  smlist.mlist = movegen.begin();
-  movepicker.score_moves(smlist, ply, hash_move);
-  for (int idx = 0; idx < movegen.size(); ++idx) {
-    Move::Type m = movepicker.get_next_move(smlist, idx);
+  // Quiet moves searched so far, for the history heuristics
+  Move::Type quiets[Move::MaxMoves];
+  size_t n_quiets = 0;
+
+  MovePicker movepicker(pos, heuristics, ply, hash_move);
+  Move::Type m, first_move = Move::Type::NONE;
+  while ((m = movepicker.next_move()) != Move::Type::NONE) {
+    if (first_move == Move::Type::NONE)
+      first_move = m;
 
     pos.make_move(m, gl);
     hash_list[game_ply + ply] = pos.hash();
@@ -215,7 +199,7 @@ int Searcher::alpha_beta(int alpha, int beta, depth_t depth, depth_t ply)
     pos.unmake_move(m, gl);
 
     if (score >= beta) {  // Oh yeah, cutoff
-      movepicker.reg_beta_cutoff(smlist, idx, ply, depth);
+      heuristics.reg_beta_cutoff(m, quiets, n_quiets, ply, depth);
       ttable.record(pos.hash(), depth, score, eval, m, TTScoreType::BetaBound, ply);
       return beta;
     }
@@ -225,10 +209,25 @@ int Searcher::alpha_beta(int alpha, int beta, depth_t depth, depth_t ply)
       pv_found = true;
       best_move = m;
     }
+
+    if (pos.piece(Move::to_sq(m)) == Piece::NONE)
+      quiets[n_quiets++] = m;
+  }
+
+  // Test if the current position is checkmate or stalemate
+  if (first_move == Move::Type::NONE) {
+    if (pos.checkers()) // Oops... Checkmate
+      score = -(int)(Score::MATE_SCORE - (ply + 1));  // Checkmate score based on ply
+    else
+      score = Score::DRAW_SCORE; // Stalemate, draw
+
+    ttable.record(pos.hash(), depth, score, eval,
+      Move::Type::NONE, TTScoreType::ExactScore, ply);
+    return score;
   }
 
   if (!pv_found)
-    best_move = *movegen.begin();
+    best_move = first_move;
 
   ttable.record(pos.hash(), depth, score, eval, best_move,
     pv_found ? TTScoreType::ExactScore : TTScoreType::AlphaBound, ply);
@@ -245,23 +244,24 @@ std::string Searcher::extract_pv(Move::Type root_move)
   std::stringstream ss;
   ss << Move::to_str(root_move) << ' ';
   Position p(pos);
-  p.make_move(root_move, GameLine());
+  p.make_move(root_move);
 
-  TranspositionTable::Entry* e;
-  e = ttable.probe(p.hash());
-  if (e == nullptr)
+  TranspositionTable::Entry e;
+  if (!ttable.probe(p.hash(), e))
     return Move::to_str(root_move);
 
   Move::Type m;
-  while ((m = e->get_best_move()) != Move::Type::NONE) {
-    assert(p.is_ok(m));
+  depth_t length = 1;
+  while (((m = e.get_best_move()) != Move::Type::NONE) && (++length < MaxPly)) {
+    // The TT only verifies 16 bits of the key, so the entry might belong
+    // to another position. Make sure the move is legal before playing it
+    if (!p.is_ok(m, false))
+      break;
 
     ss << Move::to_str(m) << ' ';
 
-    p.make_move(m, GameLine());
-    e = ttable.probe(p.hash());
-
-    if (e == nullptr)
+    p.make_move(m);
+    if (!ttable.probe(p.hash(), e))
       break;
   }
   
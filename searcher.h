@@ -6,6 +6,7 @@
 #include "evaluator.h"
 #include "movepicker.h"
 #include "ttable.h"
+#include "evalcache.h"
 #include <iostream>
 #include <algorithm>
 
@@ -18,23 +19,25 @@ class Searcher
   std::ostream &os;
   HashList hash_list;
   depth_t game_ply;
-  MovePicker movepicker;
+  Heuristics heuristics;
   bool allow_nullmove[MaxPly];
 
   typedef std::vector<ScoredMove> RootMoveList;
 public:
   const depth_t NullMoveMinDepth = 3;
   const depth_t NullMovePruningDepth = 2;
-  const int AspirationWindowSize = 40;
+  const int AspirationWindowSize = 4;
   TranspositionTable ttable;
+  EvalCache evalcache;
 
   Searcher() = delete;
   Searcher(Position& pos_, std::ostream &os_) :
-    pos(pos_), os(os_), movepicker(pos), nodes(0), tthits(0) {}
+    pos(pos_), os(os_), heuristics(pos), nodes(0), tthits(0) {}
   ~Searcher() {};
 
   inline void reset();
   inline bool is_draw(depth_t ply);
+  inline int evaluate();
   uint64_t search(depth_t depth, const HashList& hl);
   int alpha_beta(int alpha, int beta, depth_t depth, depth_t ply);
   int qsearch(int alpha, int beta, int depth, int ply);
@@ -42,7 +45,17 @@ public:
 };
 
 inline void Searcher::reset() {
-  movepicker.reset();
+  heuristics.reset();
+}
+
+// Static evaluation of the current position, through the evaluation cache
+inline int Searcher::evaluate() {
+  int eval;
+  if (!evalcache.probe(pos.hash(), eval)) {
+    eval = Evaluator(pos).eval();
+    evalcache.store(pos.hash(), eval);
+  }
+  return eval;
 }
 
 // Test if the position is draw by insuffecient material or repetition
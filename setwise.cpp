@@ -0,0 +1,82 @@
+#include "setwise.h"
+#include "cpu.h"
+#if defined(__AVX2__) || defined(USE_CPU_DISPATCH)
+#include <immintrin.h>
+#endif
+
+namespace Attacks {
+  namespace {
+    using namespace Bitboard;
+
+    SliderAttacks fill_generic(uint64_t orth, uint64_t diag, uint64_t occ)
+    {
+      const uint64_t Empty = ~occ;
+      return {
+        occluded_fill<8>(orth, Empty) | occluded_fill<-8>(orth, Empty)
+        | occluded_fill<1>(orth, Empty) | occluded_fill<-1>(orth, Empty),
+        occluded_fill<9>(diag, Empty) | occluded_fill<-9>(diag, Empty)
+        | occluded_fill<7>(diag, Empty) | occluded_fill<-7>(diag, Empty)
+      };
+    }
+
+#if defined(__AVX2__) || defined(USE_CPU_DISPATCH)
+#ifdef USE_CPU_DISPATCH
+BEGIN_TARGET("avx2")
+#endif
+    // Shift each lane up or down the board by its own count
+    template <bool Up> inline __m256i shift_lanes(__m256i b, __m256i s)
+    {
+      return Up ? _mm256_sllv_epi64(b, s) : _mm256_srlv_epi64(b, s);
+    }
+
+    // One direction per lane, the shifts of 1, 8, 7 and 9 going up the
+    // board (East, North, North-West and North-East) or down it
+    template <bool Up> inline __m256i fill_lanes(__m256i gen, __m256i empty)
+    {
+      const __m256i Shift1 = _mm256_setr_epi64x(1, 8, 7, 9);
+      const __m256i Shift2 = _mm256_add_epi64(Shift1, Shift1);
+      const __m256i Shift4 = _mm256_add_epi64(Shift2, Shift2);
+      // The squares a step can land on, as in occluded_fill()
+      const __m256i Mask = Up ?
+        _mm256_setr_epi64x(~FileAMask, Universe, ~FileHMask, ~FileAMask)
+        : _mm256_setr_epi64x(~FileHMask, Universe, ~FileAMask, ~FileHMask);
+
+      __m256i pro = _mm256_and_si256(empty, Mask);
+      gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes<Up>(gen, Shift1)));
+      pro = _mm256_and_si256(pro, shift_lanes<Up>(pro, Shift1));
+      gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes<Up>(gen, Shift2)));
+      pro = _mm256_and_si256(pro, shift_lanes<Up>(pro, Shift2));
+      gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shift_lanes<Up>(gen, Shift4)));
+      return _mm256_and_si256(shift_lanes<Up>(gen, Shift1), Mask);
+    }
+
+    SliderAttacks fill_avx2(uint64_t orth, uint64_t diag, uint64_t occ)
+    {
+      const __m256i Gen = _mm256_setr_epi64x((long long)orth, (long long)orth,
+                                             (long long)diag, (long long)diag);
+      const __m256i Empty = _mm256_set1_epi64x((long long)~occ);
+      const __m256i Attacks = _mm256_or_si256(fill_lanes<true>(Gen, Empty),
+                                              fill_lanes<false>(Gen, Empty));
+      alignas(32) uint64_t lanes[4];
+      _mm256_store_si256((__m256i*)lanes, Attacks);
+      return { lanes[0] | lanes[1], lanes[2] | lanes[3] };
+    }
+#ifdef USE_CPU_DISPATCH
+END_TARGET()
+#endif
+#endif
+  }
+
+  SliderAttacks slider_attacks_setwise(uint64_t orth, uint64_t diag, uint64_t occ)
+  {
+#ifdef USE_CPU_DISPATCH
+    if (CPU::Current == CPU::AVX2)
+      return fill_avx2(orth, diag, occ);
+    return fill_generic(orth, diag, occ);
+#elif defined(__AVX2__)
+    return fill_avx2(orth, diag, occ);
+#else
+    return fill_generic(orth, diag, occ);
+#endif
+  }
+}
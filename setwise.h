@@ -0,0 +1,50 @@
+#ifndef INC_SETWISE_H_
+#define INC_SETWISE_H_
+#include "yaka.h"
+#include "bitboard.h"
+
+// Set-wise attack generation: the union of the attacks of a whole set of
+// sliders at once, by Kogge-Stone occluded fills, instead of a lookup per
+// slider. It is meant for attack maps (what a side attacks, what attacks
+// a set of squares); the attacks of a single piece, as for its mobility,
+// are still cheaper from the magics
+namespace Attacks {
+  // The squares attacked in direction Dir by the sliders in 'gen', where
+  // only the squares in 'empty' let a ray through
+  template <int Dir>
+  inline uint64_t occluded_fill(uint64_t gen, uint64_t empty)
+  {
+    // The squares a step in this direction can land on, so that no ray
+    // wraps around the board
+    const uint64_t Mask = Bitboard::shift_bb<Dir>(Bitboard::Universe);
+    const int Shift = Dir > 0 ? Dir : -Dir;
+    uint64_t pro = empty & Mask;
+    if (Dir > 0) {
+      gen |= pro & (gen << Shift);
+      pro &= pro << Shift;
+      gen |= pro & (gen << (2 * Shift));
+      pro &= pro << (2 * Shift);
+      gen |= pro & (gen << (4 * Shift));
+    }
+    else {
+      gen |= pro & (gen >> Shift);
+      pro &= pro >> Shift;
+      gen |= pro & (gen >> (2 * Shift));
+      pro &= pro >> (2 * Shift);
+      gen |= pro & (gen >> (4 * Shift));
+    }
+    return Bitboard::shift_bb<Dir>(gen);
+  }
+
+  struct SliderAttacks {
+    uint64_t orthogonal;  // Of the sliders given as rooks
+    uint64_t diagonal;    // Of the sliders given as bishops
+  };
+
+  // The union of the attacks of the rook-like sliders in 'orth' and of
+  // the bishop-like ones in 'diag', with the pieces in 'occ' blocking.
+  // With AVX2, the four directions of a sign are filled in one register
+  SliderAttacks slider_attacks_setwise(uint64_t orth, uint64_t diag, uint64_t occ);
+}
+
+#endif
@@ -1,30 +1,457 @@
 #include "ttable.h"
+#include "zobrist.h"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <chrono>
+#include <atomic>
+#endif
 
+namespace {
+  // Header of a hash file written by TranspositionTable::save(), and of a
+  // shared memory table. The entries follow right after it; the header
+  // fills a whole cache line so that a mapped table keeps the alignment of
+  // an allocated one.
+  struct HashFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    key_t signature;  // Identifies the Zobrist keys of the build
+    uint64_t size_mb;
+    uint8_t generation;
+    uint8_t padding[31];
+  };
+  static_assert(sizeof(HashFileHeader) == 64, "Hash file header must be 64 bytes");
+  static_assert(sizeof(std::atomic<uint8_t>) == 1, "The shared generation must fit its header byte");
 
+  const char HashFileMagic[8] = { 'Y', 'A', 'K', 'A', 'H', 'A', 'S', 'H' };
+  const uint32_t HashFileVersion = 4;
+
+  // Entries are only meaningful to a build that hashes positions the same
+  // way, so mix all the Zobrist keys into a single signature
+  key_t hash_signature()
+  {
+    key_t sig = Zobrist::SideHash;
+    for (Piece::Type pc = Piece::WHITE_PAWN; pc <= Piece::BLACK_KING; ++pc)
+      for (Square::Type sq = Square::A1; sq < Square::SQ_NB; ++sq)
+        sig = (sig ^ Zobrist::PieceHash[pc][sq]) * 0x9E3779B97F4A7C15ULL;
+    for (int cr = 0; cr < Castling::CASTLING_RIGHT_NB; ++cr)
+      sig = (sig ^ Zobrist::CastlingHash[cr]) * 0x9E3779B97F4A7C15ULL;
+    for (Square::Type sq = Square::A1; sq < Square::SQ_NB; ++sq)
+      sig = (sig ^ Zobrist::EpHash[sq]) * 0x9E3779B97F4A7C15ULL;
+    return sig;
+  }
+
+  void init_header(HashFileHeader& header, size_t size_mb, uint8_t generation)
+  {
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, HashFileMagic, sizeof(HashFileMagic));
+    header.version = HashFileVersion;
+    header.entry_size = sizeof(TranspositionTable::Entry);
+    header.signature = hash_signature();
+    header.size_mb = size_mb;
+    header.generation = generation;
+  }
+
+  // The first and last index, in a table of 'to' entries, of the positions
+  // found at index 'i' of a table of 'from' entries
+  void index_range(uint64_t i, uint64_t from, uint64_t to, uint64_t& first, uint64_t& last)
+  {
+#if defined(__SIZEOF_INT128__)
+    typedef unsigned __int128 uint128_t;
+    first = (uint64_t)(((uint128_t)i * to) / from);
+    last = (uint64_t)(((uint128_t)(i + 1) * to - 1) / from);
+#else
+    first = (uint64_t)(((long double)i * to) / from);
+    last = std::min((uint64_t)(((long double)(i + 1) * to) / from), to - 1);
+#endif
+  }
+
+  bool is_compatible(const HashFileHeader& header, uint64_t file_size)
+  {
+    if (std::memcmp(header.magic, HashFileMagic, sizeof(HashFileMagic)))
+      return false;
+    if ((header.version != HashFileVersion)
+      || (header.entry_size != sizeof(TranspositionTable::Entry))
+      || (header.signature != hash_signature()))
+      return false;
+    if (header.size_mb >= (1ULL << 28))
+      return false;
+    return file_size >= sizeof(HashFileHeader)
+      + sizeof(TranspositionTable::Entry) * TranspositionTable::entries_in(header.size_mb);
+  }
+}
 
 TranspositionTable::TranspositionTable()
 {
   entry = nullptr;
-  log2size = modulo = 0;
+  mapping = nullptr;
+  shared = false;
+  shared_generation = nullptr;
+  size_mb = n_entries = mapping_size = 0;
+  generation = 0;
+  std::memset(&stats, 0, sizeof(stats));
 }
 
 
 TranspositionTable::~TranspositionTable()
 {
-  delete[] entry;
+  release();
+}
+
+void TranspositionTable::release()
+{
+#ifndef _WIN32
+  if (mapping != nullptr)
+    munmap(mapping, mapping_size);
+  else
+#endif
+    delete[] entry;
+
+  // Leaving a shared table, go on from its generation
+  if (shared_generation != nullptr)
+    generation = shared_generation->load(std::memory_order_relaxed);
+
+  entry = nullptr;
+  mapping = nullptr;
+  mapping_size = 0;
+  shared = false;
+  shared_generation = nullptr;
 }
 
 void TranspositionTable::clear() {
-  std::memset(entry, 0, sizeof(Entry) * (1ULL << log2size));
+  std::memset(entry, 0, sizeof(Entry) * n_entries);
+  std::memset(&stats, 0, sizeof(stats));
   generation = 0;
+  if (shared_generation != nullptr)
+    shared_generation->store(0, std::memory_order_relaxed);
+}
+
+size_t TranspositionTable::entries_in(size_t mb)
+{
+  return std::max<size_t>((mb << 20) / sizeof(Entry), 1);
 }
 
-void TranspositionTable::resize(size_t log2size_) {
+// Resize the table, moving the current entries into the new one
+void TranspositionTable::resize(size_t mb) {
+  const size_t NewEntries = entries_in(mb);
+  Entry* table = new Entry[NewEntries];
+  std::memset(table, 0, sizeof(Entry) * NewEntries);
+
   if (entry != nullptr)
-    delete[] entry;
+    migrate(table, NewEntries);
+  else
+    generation = 0;
+
+  release();
+  entry = table;
+  size_mb = mb;
+  n_entries = NewEntries;
+  std::memset(&stats, 0, sizeof(stats));
+}
+
+// Copy the valid entries into 'table' of 'n' entries. An entry only keeps
+// 16 bits of its hash, so its new index isn't known exactly, only the
+// range of indices that its current index maps to. The entry is copied to
+// every index of that range if it has at most two, as when shrinking or
+// doubling the table, and to its first index only otherwise, since the
+// other copies could never be found. Conflicts keep the deepest entry.
+// The copies are marked stale, i.e. of the previous generation, so that
+// record() replaces them rather than keeping them over the new entries.
+// The new table is split into slices, each filled by its own thread, so
+// the threads never write to the same entry.
+void TranspositionTable::migrate(Entry* table, size_t n) const
+{
+  const size_t Threads = std::max(1u, std::thread::hardware_concurrency());
+  const uint8_t Stale = (current_generation() + 63) & 63;
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < Threads; ++t)
+    workers.emplace_back([=]() {
+      const uint64_t SliceBegin = (n * t) / Threads, SliceEnd = (n * (t + 1)) / Threads;
+      if (SliceBegin == SliceEnd)
+        return;
+
+      uint64_t i, first, last;
+      index_range(SliceBegin, n, n_entries, i, last);
+      if (i > 0) --i;
+
+      for (; i < n_entries; ++i) {
+        index_range(i, n_entries, n, first, last);
+        if (first >= SliceEnd)
+          break;
+        if (entry[i].get_type() == TTScoreType::EmptyScore)
+          continue;
+
+        Entry e = entry[i];
+        const uint16_t Key = e.key ^ e.checksum();
+        e.set_generation(Stale);
+        e.set_key(Key);
+
+        if (last > first + 1)
+          last = first;
+        first = std::max(first, SliceBegin);
+        last = std::min(last, SliceEnd - 1);
+        for (uint64_t j = first; j <= last; ++j)
+          if ((table[j].get_type() == TTScoreType::EmptyScore)
+            || (table[j].get_depth() < e.get_depth()))
+            table[j] = e;
+      }
+    });
+
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+// Permille of the table used by the current search, estimated from the
+// first 1000 entries as UCI's 'info hashfull' expects
+int TranspositionTable::hashfull() const
+{
+  const size_t Samples = std::min<size_t>(1000, n_entries);
+  const uint8_t Generation = current_generation();
+  size_t used = 0;
+  for (size_t i = 0; i < Samples; ++i)
+    if ((entry[i].get_type() != TTScoreType::EmptyScore)
+      && (entry[i].get_generation() == Generation))
+      ++used;
+  return int((used * 1000) / Samples);
+}
 
-  log2size = log2size_;
-  modulo = (1 << log2size) - 1;
-  entry = new Entry[1ULL << log2size];
-  clear();
-}
\ No newline at end of file
+std::string TranspositionTable::stats_to_str() const
+{
+  uint64_t used = 0, current = 0;
+  uint64_t depths[256] = { 0 };
+  const uint8_t Generation = current_generation();
+  for (size_t i = 0; i < n_entries; ++i) {
+    if (entry[i].get_type() == TTScoreType::EmptyScore)
+      continue;
+    ++used;
+    if (entry[i].get_generation() == Generation)
+      ++current;
+    ++depths[entry[i].get_depth()];
+  }
+
+  auto percent = [](uint64_t n, uint64_t total) {
+    return total ? (100. * n) / total : 0.;
+  };
+
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  ss << "Entries:        " << n_entries << " (" << size_mb << " MB, "
+    << sizeof(Entry) << " bytes each)\n";
+  ss << "Used:           " << used << " (" << percent(used, n_entries) << "%), "
+    << current << " from the current generation\n";
+  ss << "Probes:         " << stats.probes << ", hit rate "
+    << percent(stats.hits, stats.probes) << "%\n";
+  ss << "Stores:         " << stats.stores << ", replacement rate "
+    << percent(stats.replacements, stats.stores) << "%, rejected "
+    << percent(stats.rejections, stats.stores) << "%\n";
+  ss << "Type-1 collisions (est.): " << std::scientific
+    << stats.occupied_misses * std::ldexp(1., -KeyBits) << std::fixed << '\n';
+  ss << "Depth histogram:\n";
+  for (int d = 0; d < 256; ++d)
+    if (depths[d])
+      ss << std::setw(5) << d << ": " << std::setw(12) << depths[d]
+        << " (" << std::setw(6) << percent(depths[d], used) << "%)\n";
+  return ss.str();
+}
+
+// Write the table to a temporary file renamed over 'filename' once
+// complete. The file may be mapped by load() in this or another process,
+// which then keeps the old file rather than seeing it truncated
+bool TranspositionTable::save(const std::string& filename) const
+{
+  if (entry == nullptr)
+    return false;
+
+  HashFileHeader header;
+  init_header(header, size_mb, current_generation());
+
+  const std::string TmpName = filename + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream out(TmpName, std::ios::binary);
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)entry, sizeof(Entry) * n_entries);
+  out.close();
+#ifdef _WIN32
+  // rename() doesn't replace an existing file there
+  if (out)
+    std::remove(filename.c_str());
+#endif
+  if (!out || (std::rename(TmpName.c_str(), filename.c_str()) != 0)) {
+    std::remove(TmpName.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Load a table written by save(). Where possible the file is mapped
+// copy-on-write, so only the pages the search touches are ever read and
+// the file itself is never modified.
+bool TranspositionTable::load(const std::string& filename)
+{
+  HashFileHeader header;
+#ifdef _WIN32
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  if (!in)
+    return false;
+  uint64_t file_size = (uint64_t)in.tellg();
+  in.seekg(0);
+  if ((file_size < sizeof(header)) || !in.read((char*)&header, sizeof(header))
+    || !is_compatible(header, file_size))
+    return false;
+
+  release();
+  resize((size_t)header.size_mb);
+  if (!in.read((char*)entry, sizeof(Entry) * n_entries)) {
+    clear();
+    return false;
+  }
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size < sizeof(header))) {
+    close(fd);
+    return false;
+  }
+
+  void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  std::memcpy(&header, p, sizeof(header));
+  if (!is_compatible(header, (uint64_t)st.st_size)) {
+    munmap(p, (size_t)st.st_size);
+    return false;
+  }
+
+  use_mapping(p, (size_t)st.st_size);
+#endif
+  generation = header.generation;
+  return true;
+}
+
+// Use the table stored in a mapped hash file or shared memory segment,
+// right after its (already validated) header
+void TranspositionTable::use_mapping(void* p, size_t bytes)
+{
+  HashFileHeader header;
+  std::memcpy(&header, p, sizeof(header));
+
+  release();
+  mapping = p;
+  mapping_size = bytes;
+  entry = (Entry*)((char*)p + sizeof(header));
+  size_mb = (size_t)header.size_mb;
+  n_entries = entries_in(size_mb);
+  std::memset(&stats, 0, sizeof(stats));
+}
+
+// Back the table by the named POSIX shared memory segment, creating it
+// with a table of 'mb' MB if it doesn't exist yet. Otherwise the existing
+// table is used as is, whatever its size. Every process attached to the
+// segment reads and writes the same entries without locks: probe() copies
+// an entry before checking its checksum, and the search only uses that
+// copy, so a concurrent write can't mix two positions.
+bool TranspositionTable::attach_shared(const std::string& name, size_t mb)
+{
+#ifdef _WIN32
+  return false;
+#else
+  const std::string ShmName = name[0] == '/' ? name : '/' + name;
+  bool created = true;
+  int fd = shm_open(ShmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if ((fd < 0) && (errno == EEXIST)) {
+    created = false;
+    fd = shm_open(ShmName.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  size_t bytes = sizeof(HashFileHeader) + sizeof(Entry) * entries_in(mb);
+  if (created) {
+    // A new segment is zero filled, i.e. all its entries are empty
+    if (ftruncate(fd, (off_t)bytes) != 0) {
+      close(fd);
+      shm_unlink(ShmName.c_str());
+      return false;
+    }
+  }
+  else {
+    // Wait for the process creating the segment to size it
+    for (int i = 0; (fstat(fd, &st) == 0) && (st.st_size == 0) && (i < 100); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size < sizeof(HashFileHeader))) {
+      close(fd);
+      return false;
+    }
+    bytes = (size_t)st.st_size;
+  }
+
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  HashFileHeader header;
+  if (created) {
+    // Write the magic last: other processes wait for it before using
+    // the table
+    init_header(header, mb, 0);
+    std::memcpy((char*)p + sizeof(header.magic), (char*)&header + sizeof(header.magic),
+      sizeof(header) - sizeof(header.magic));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(p, header.magic, sizeof(header.magic));
+  }
+  else {
+    for (int i = 0; std::memcmp(p, HashFileMagic, sizeof(HashFileMagic)) && (i < 100); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::memcpy(&header, p, sizeof(header));
+    if (!is_compatible(header, bytes)) {
+      munmap(p, bytes);
+      return false;
+    }
+  }
+
+  use_mapping(p, bytes);
+  shared = true;
+  // Searches of all the processes share the generation of the header
+  shared_generation = reinterpret_cast<std::atomic<uint8_t>*>(
+    (char*)p + offsetof(HashFileHeader, generation));
+  generation = shared_generation->load(std::memory_order_relaxed);
+  return true;
+#endif
+}
+
+// Remove the named shared memory segment. Processes still attached to it
+// keep using it until they resize the table or exit.
+bool TranspositionTable::unlink_shared(const std::string& name)
+{
+#ifdef _WIN32
+  return false;
+#else
+  const std::string ShmName = name[0] == '/' ? name : '/' + name;
+  return shm_unlink(ShmName.c_str()) == 0;
+#endif
+}
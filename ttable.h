@@ -2,6 +2,10 @@
 #define TTABLE_H_
 #include "yaka.h"
 #include "score.h"
+#include "misc.h"
+#include <string>
+#include <cstring>
+#include <atomic>
 
 enum class TTScoreType {
   EmptyScore,
@@ -12,8 +16,8 @@ enum class TTScoreType {
 
 class TranspositionTable
 {
-  size_t log2size;
-  size_t modulo;  // index of a position in table = <hash> mod (modulo + 1)
+  size_t size_mb;
+  size_t n_entries;
 public:
   static inline int to_tt_score(int s, depth_t ply)
   {
@@ -31,27 +35,43 @@ public:
     return s;
   }
 
+  // A 10 byte entry. Only the low 16 bits of the hash are stored, as the
+  // index of the entry is taken from its high bits. Scores are stored as
+  // they are, since search scores (mates included) fit in 16 bits
   struct Entry
   {
-    key_t key;
+    uint16_t key;
     uint8_t depth;
-    int16_t score, eval_score;
-    uint16_t best_move;
     // 'other' stores the TTScoreType and the generation of this entry:
     // <TTScoreType> = other & 0x03
     // <generation>  = other >> 2
     uint8_t other;
+    int16_t score, eval_score;
+    uint16_t best_move;
 
-    key_t hash() const { return key; }
-    key_t& hash() { return key; }
+    // A shared table may be read while another process writes the same
+    // entry. The key is stored XORed with a checksum of the rest of the
+    // entry, so a torn entry doesn't match. set_key() must be called after
+    // all other fields are set
+    uint16_t checksum() const {
+      return uint16_t(depth | (other << 8)) ^ uint16_t(score) ^ uint16_t(eval_score) ^ best_move;
+    }
+    bool matches(key_t hash) const { return (key ^ checksum()) == (uint16_t)hash; }
+    void set_key(key_t hash) { key = (uint16_t)hash ^ checksum(); }
 
     depth_t get_depth() const { return (depth_t)depth; }
     void set_depth(depth_t depth_) { depth = (uint8_t) depth_; }
 
     int get_score(int ply) const { return from_tt_score(score, ply); }
-    void set_score(int s) { score = (int16_t) s; }
+    void set_score(int s) {
+      assert((s >= INT16_MIN) && (s <= INT16_MAX));
+      score = (int16_t) s;
+    }
     int get_eval() const { return eval_score; }
-    void set_eval(int s) { eval_score = (int16_t) s; }
+    void set_eval(int s) {
+      assert((s >= INT16_MIN) && (s <= INT16_MAX));
+      eval_score = (int16_t) s;
+    }
 
     Move::Type get_best_move() const { return (Move::Type) best_move; }
     void set_best_move(Move::Type m) { best_move = (uint16_t) m; }
@@ -71,75 +91,126 @@ public:
       other = (other & 0x03) | (gen << 2);
     }
   };
+
+  // Counters gathered while searching, reported by the 'ttstats' command
+  struct Stats
+  {
+    uint64_t probes, hits;
+    uint64_t occupied_misses; // Probes that met an entry of another position
+    uint64_t stores, replacements, rejections;
+  };
+
+  // Number of key bits compared by probe(). A probe of an entry holding a
+  // different position wrongly hits with a chance of 2^-KeyBits
+  static const int KeyBits = 16;
 private:
   Entry* entry;
   uint8_t generation;
+  // The generation in the header of a shared memory table, which all the
+  // attached processes bump and read instead of their own
+  std::atomic<uint8_t>* shared_generation;
+  Stats stats;
+  void* mapping;  // Start of the hash file or shared memory mapped, if any
+  size_t mapping_size;
+  bool shared;  // True if 'mapping' is a shared memory segment
+
+  void release();
+  void use_mapping(void* p, size_t bytes);
+  void migrate(Entry* table, size_t n) const;
+  inline size_t index(key_t hash) const;
+  inline uint8_t current_generation() const;
 public:
   TranspositionTable();
   ~TranspositionTable();
   void clear();
-  void resize(size_t log2size_);
+  static size_t entries_in(size_t mb);
+  void resize(size_t mb);
+  bool is_allocated() const { return entry != nullptr; }
+  size_t get_size_mb() const { return size_mb; }
+  bool is_shared() const { return shared; }
+  int hashfull() const;
+  std::string stats_to_str() const;
+  bool save(const std::string& filename) const;
+  bool load(const std::string& filename);
+  bool attach_shared(const std::string& name, size_t mb);
+  static bool unlink_shared(const std::string& name);
   inline void inc_gen();
   inline void record(key_t hash, depth_t depth, int score,
     int eval_score, Move::Type best_move, TTScoreType type, depth_t ply);
-  inline void record_eval(key_t hash, int eval_score);
-  inline Entry* probe(key_t hash);
+  inline bool probe(key_t hash, Entry& e);
 };
 
+static_assert(sizeof(TranspositionTable::Entry) == 10, "Unexpected TT entry size");
+
+// Map the hash onto [0, n_entries) with the high half of hash * n_entries.
+// This works for any table size and costs a multiplication, not a division
+inline size_t TranspositionTable::index(key_t hash) const
+{
+  return (size_t)Misc::mul_hi64(hash, n_entries);
+}
+
+inline uint8_t TranspositionTable::current_generation() const
+{
+  return shared_generation ? shared_generation->load(std::memory_order_relaxed) : generation;
+}
+
 inline void TranspositionTable::inc_gen() {
-  generation = (generation + 1) & 63;
+  generation = (current_generation() + 1) & 63;
+  if (shared_generation)
+    shared_generation->store(generation, std::memory_order_relaxed);
 }
 
 inline void TranspositionTable::record(key_t hash, depth_t depth, int score,
   int eval_score, Move::Type best_move, TTScoreType type, depth_t ply)
 {
-  Entry& e = entry[hash & modulo];
-
-  assert(e.get_generation() <= generation);
+  Entry& e = entry[index(hash)];
+  const uint8_t Generation = current_generation();
+  ++stats.stores;
+
+  // An entry of any other generation is stale: it was left by an earlier
+  // search or moved by resize(), and is always replaced. Generations wrap
+  // around, so no generation counts as newer. An entry of the current one
+  // is only replaced by a deeper entry, and an exact score only by another
+  bool do_record = (e.get_type() == TTScoreType::EmptyScore)
+    || (e.get_generation() != Generation);
+  if (!do_record)
+    do_record = (depth > e.get_depth())
+      && ((type == TTScoreType::ExactScore) || (e.get_type() != TTScoreType::ExactScore));
 
-  bool do_record = (e.get_type() == TTScoreType::EmptyScore);
   if (!do_record) {
-    if (e.get_generation() != generation)
-      do_record = true;
-    if ((type != TTScoreType::ExactScore) && (e.get_type() == TTScoreType::ExactScore))
-      do_record = false;
-    if (depth <= e.get_depth())
-      do_record = false;
+    ++stats.rejections;
+    return;
   }
 
-  if (do_record) {
-    e.hash() = hash;
-    e.set_depth(depth);
-    e.set_score(to_tt_score(score, ply));
-    e.set_eval(eval_score);
-    e.set_best_move(best_move);
-    e.set_type(type);
-    e.set_generation(generation);
-  }
+  if ((e.get_type() != TTScoreType::EmptyScore) && !e.matches(hash))
+    ++stats.replacements;
+
+  e.set_depth(depth);
+  e.set_score(to_tt_score(score, ply));
+  e.set_eval(eval_score);
+  e.set_best_move(best_move);
+  e.set_type(type);
+  e.set_generation(Generation);
+  e.set_key(hash);
 }
 
-inline TranspositionTable::Entry* TranspositionTable::probe(key_t hash)
+// Copy the entry of the position into 'e'. The copy is validated and used
+// instead of the entry itself, which another process sharing the table may
+// overwrite at any time
+inline bool TranspositionTable::probe(key_t hash, Entry& e)
 {
-  Entry* e;
-  if ((e = &entry[hash & modulo])->hash() == hash) {
-    assert(e->get_type() != TTScoreType::EmptyScore);
-    return e;
+  std::memcpy(&e, &entry[index(hash)], sizeof(Entry));
+  ++stats.probes;
+  if (e.get_type() == TTScoreType::EmptyScore)
+    return false;
+
+  if (!e.matches(hash)) {
+    ++stats.occupied_misses;
+    return false;
   }
-  else return nullptr;
-
-  return e;
-}
-
-inline void TranspositionTable::record_eval(key_t hash, int eval_score) {
-  size_t idx = hash & modulo;
-  if (entry[idx].get_depth() >= 0)
-    return;
-  assert((entry[idx].get_type() == TTScoreType::EmptyScore) ||
-    (hash != entry[idx].hash()));
 
-  entry[idx].set_eval(eval_score);
-  entry[idx].set_score(eval_score);
-  entry[idx].set_type(TTScoreType::ExactScore);
+  ++stats.hits;
+  return true;
 }
 
 #endif
@@ -30,6 +30,11 @@ void UCI::handle_token(const Token& token)
   else if (token == "moves")      moves();
   else if (token == "move")       move();
   else if (token == "perft")      perft();
+  else if (token == "perftstats") perftstats();
+  else if (token == "dperft")     dperft();
+  else if (token == "uperft")     uperft();
+  else if (token == "benchsliders") bench_sliders();
+  else if (token == "benchmakemove") bench_make_move();
   else if (token == "bench")      bench();
   else if (token == "verify")     verify();
   else if (token == "rgame")      rgame();
@@ -39,6 +44,12 @@ void UCI::handle_token(const Token& token)
   else if (token == "testsearch") test_search();
   else if (token == "search")     search();
   else if (token == "SEE")        see();
+  else if (token == "savehash")   save_hash();
+  else if (token == "loadhash")   load_hash();
+  else if (token == "ttstats")    tt_stats();
+  else if (token == "sharehash")  share_hash();
+  else if (token == "unlinkhash") unlink_hash();
+  else if (token == "resizehash") resize_hash();
   else                            handle_error("Unknown Token", token);
 }
 
@@ -83,7 +94,7 @@ void UCI::move(size_t idx)
   MoveGen movegen(pos);
   for (Move::Type * mlist_ptr = movegen.begin(); *mlist_ptr != Move::Type::NONE; mlist_ptr++) {
     if (Move::to_str(*mlist_ptr) == token_list[idx]) {
-      pos.make_move(*mlist_ptr, GameLine());
+      pos.make_move(*mlist_ptr);
       hash_list.push_back(pos.hash());
       if (idx < (token_list.size() - 1)) move(idx + 1);
       return;
@@ -99,39 +110,129 @@ void UCI::perft()
     return;
   }
   depth_t depth = Misc::convert_to <depth_t>(token_list[1]);
+  PerftBench pb(pos, os);
+  if (token_list.back() == "canonical") {
+    // Symmetric positions share hash entries
+    pb.set_canonical(true);
+    token_list.pop_back();
+  }
   if (token_list.size() > 2) {
-    PerftBench pb(pos, os);
-    int power_two_size = Misc::convert_to<int>(token_list[2]);
-    if (power_two_size >= 32) handle_error("Too Large Size", token_list[2]);
-    else {
-      pb.allocate_hash(power_two_size);
-      pb.do_perft(depth);
+    size_t hash_mb = Misc::convert_to<size_t>(token_list[2]);
+    // A size of 0 runs without a hash table
+    if ((hash_mb > 0) && !pb.allocate_hash(hash_mb)) {
+      handle_error("Could not allocate hash", token_list[2]);
+      return;
     }
-  } else PerftBench(pos, os).do_perft(depth);
+  }
+  // perft <depth> [hash MB] [threads] [split depth] [canonical]
+  if (token_list.size() > 3)
+    pb.set_threads(Misc::convert_to<size_t>(token_list[3]), token_list.size() > 4 ?
+      Misc::convert_to<depth_t>(token_list[4]) : PerftBench::DefaultSplitDepth);
+  pb.do_perft(depth);
+}
+
+void UCI::perftstats()
+{
+  if (token_list.size() < 2) {
+    os << "Usage: perftstats <depth> [divide]\n";
+    return;
+  }
+  depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
+  bool divide = (token_list.size() > 2) && (token_list[2] == "divide");
+  PerftBench(pos, os).do_perftstats(depth, divide);
+}
+
+void UCI::dperft()
+{
+  if (token_list.size() < 5) {
+    os << "Usage: dperft <depth> <split depth> <workers> <journal file> [hash MB]\n";
+    return;
+  }
+  depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
+  depth_t split = Misc::convert_to<depth_t>(token_list[2]);
+  size_t workers = Misc::convert_to<size_t>(token_list[3]);
+  size_t hash_mb = token_list.size() > 5 ? Misc::convert_to<size_t>(token_list[5]) : 64;
+  PerftBench(pos, os).distributed_perft(depth, split, workers, token_list[4], hash_mb);
+}
+
+void UCI::uperft()
+{
+  if (token_list.size() < 2) {
+    os << "Usage: uperft <depth> [memory MB] [spill file prefix]\n";
+    return;
+  }
+  depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
+  size_t mb = token_list.size() > 2 ? Misc::convert_to<size_t>(token_list[2]) : 256;
+  std::string prefix = token_list.size() > 3 ? token_list[3] : "uperft";
+  UniquePerft(pos, os, mb, prefix).run(depth);
+}
+
+void UCI::bench_sliders()
+{
+  if (token_list.size() > 2) {
+    os << "Usage: benchsliders [million lookups]\n";
+    return;
+  }
+  size_t million = token_list.size() > 1 ? Misc::convert_to<size_t>(token_list[1]) : 100;
+  Position p;
+  SliderBench(p, os).run(million);
+}
+
+void UCI::bench_make_move()
+{
+  if (token_list.size() > 3) {
+    os << "Usage: benchmakemove [million moves] [perft depth]\n";
+    return;
+  }
+  size_t million = token_list.size() > 1 ? Misc::convert_to<size_t>(token_list[1]) : 20;
+  depth_t depth = token_list.size() > 2 ? Misc::convert_to<depth_t>(token_list[2]) : 4;
+  Position p;
+  MakeMoveBench(p, os).run(million, depth);
 }
 
 void UCI::bench()
 {
-  if (token_list.size() != 4) {
-    os << "Usage: bench <depth> <input filename (without spaces)> <output file>\n";
+  if ((token_list.size() < 4) || (token_list.size() > 6)) {
+    os << "Usage: bench <depth> <input filename (without spaces)> <output file> [threads] [hash MB]\n";
     return;
   }
   depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
   std::ifstream input(token_list[2]);
   std::ofstream output(token_list[3]);
-  PerftBench(pos, output, input, true).benchmark(depth);
+  PerftBench pb(pos, output, input, true);
+  if (!setup_perft_list(pb))
+    return;
+  pb.benchmark(depth);
 }
 
 void UCI::verify()
 {
-  if (token_list.size() != 4) {
-    os << "Usage: verify <depth> <input filename (without spaces)> <output file>\n";
+  if ((token_list.size() < 4) || (token_list.size() > 6)) {
+    os << "Usage: verify <depth> <input filename (without spaces)> <output file> [threads] [hash MB]\n";
     return;
   }
   depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
   std::ifstream input(token_list[2]);
   std::ofstream output(token_list[3]);
-  PerftBench(pos, output, input, true).verify(depth);
+  PerftBench pb(pos, output, input, true);
+  if (!setup_perft_list(pb))
+    return;
+  pb.verify(depth);
+}
+
+// The optional [threads] [hash MB] arguments of bench and verify
+bool UCI::setup_perft_list(PerftBench& pb)
+{
+  if (token_list.size() > 4)
+    pb.set_threads(Misc::convert_to<size_t>(token_list[4]));
+  if (token_list.size() > 5) {
+    size_t hash_mb = Misc::convert_to<size_t>(token_list[5]);
+    if (hash_mb && !pb.allocate_hash(hash_mb)) {
+      handle_error("Could not allocate hash", token_list[5]);
+      return false;
+    }
+  }
+  return true;
 }
 
 void UCI::rgame()
@@ -145,7 +246,7 @@ void UCI::rgame()
     if (i % 2 == 0) os << i / 2 << ". ";
     Move::Type m = movegen[Random::rand_int(movegen.size())];
     os << Move::to_str(m) << ' ';
-    pos.make_move(m, GameLine());
+    pos.make_move(m);
     ++i;
   } while (true);
   os << std::endl;
@@ -180,20 +281,24 @@ void UCI::search() {
     return;
   }
   if (token_list.size() < 3) {
-    handle_error("The hash table size was not provided", token_list[0]);
+    handle_error("The hash table size (in MB) was not provided", token_list[0]);
     return;
   }
 
   depth_t depth = Misc::convert_to<depth_t>(token_list[1]);
-  int hsize = Misc::convert_to<int>(token_list[2]);
-  searcher.ttable.resize(hsize);
+  size_t hsize = Misc::convert_to<size_t>(token_list[2]); // In MB
+  // Keep the table (it may have been loaded with 'loadhash') if its size
+  // hasn't changed. A shared table is always kept
+  if (!searcher.ttable.is_allocated()
+    || (!searcher.ttable.is_shared() && (searcher.ttable.get_size_mb() != hsize)))
+    searcher.ttable.resize(hsize);
   searcher.search(depth, hash_list);
 }
 
 void UCI::test_search()
 {
   if (token_list.size() != 5) {
-    os << "Usage: testsearch <depth> <hash table size> <input filename (without spaces)> <output file>\n";
+    os << "Usage: testsearch <depth> <hash table size in MB> <input filename (without spaces)> <output file>\n";
     return;
   }
 
@@ -221,4 +326,75 @@ void UCI::see() {
   }
 
   handle_error("Unknown move", token_list[1]);
+}
+
+void UCI::save_hash()
+{
+  if (token_list.size() != 2) {
+    os << "Usage: savehash <filename (without spaces)>" << std::endl;
+    return;
+  }
+
+  if (!searcher.ttable.save(token_list[1]))
+    handle_error("Unable to save the hash table to", token_list[1]);
+}
+
+void UCI::load_hash()
+{
+  if (token_list.size() != 2) {
+    os << "Usage: loadhash <filename (without spaces)>" << std::endl;
+    return;
+  }
+
+  if (!searcher.ttable.load(token_list[1]))
+    handle_error("Missing, corrupt or incompatible hash file", token_list[1]);
+}
+
+void UCI::tt_stats()
+{
+  if (!searcher.ttable.is_allocated()) {
+    handle_error("The hash table hasn't been allocated yet", token_list[0]);
+    return;
+  }
+
+  os << searcher.ttable.stats_to_str();
+}
+
+void UCI::share_hash()
+{
+  if (token_list.size() != 3) {
+    os << "Usage: sharehash <shared memory name> <hash table size in MB>" << std::endl;
+    return;
+  }
+
+  size_t hsize = Misc::convert_to<size_t>(token_list[2]);
+  if (!searcher.ttable.attach_shared(token_list[1], hsize)) {
+    handle_error("Unable to attach to the shared hash table", token_list[1]);
+    return;
+  }
+
+  os << "info string using shared hash table '" << token_list[1] << "' of "
+    << searcher.ttable.get_size_mb() << " MB" << std::endl;
+}
+
+void UCI::unlink_hash()
+{
+  if (token_list.size() != 2) {
+    os << "Usage: unlinkhash <shared memory name>" << std::endl;
+    return;
+  }
+
+  if (!TranspositionTable::unlink_shared(token_list[1]))
+    handle_error("Unable to remove the shared hash table", token_list[1]);
+}
+
+void UCI::resize_hash()
+{
+  if (token_list.size() != 2) {
+    os << "Usage: resizehash <hash table size in MB>" << std::endl;
+    return;
+  }
+
+  // Entries of the current table are kept, as far as the new size allows
+  searcher.ttable.resize(Misc::convert_to<size_t>(token_list[1]));
 }
\ No newline at end of file
@@ -15,6 +15,8 @@
 #include <cctype>
 #include <map>
 
+class PerftBench;
+
 class UCI {
   using Token = std::string;
   using TokenList = std::vector < std::string > ;
@@ -52,7 +54,13 @@ public:
   void move(size_t idx = 1);
   void bench();
   void perft();
+  void perftstats();
+  void dperft();
+  void uperft();
+  void bench_sliders();
+  void bench_make_move();
   void verify();
+  bool setup_perft_list(PerftBench& pb);
   void rgame();
   void eval();
   void flip();
@@ -60,6 +68,12 @@ public:
   void test_search();
   void search();
   void see();
+  void save_hash();
+  void load_hash();
+  void tt_stats();
+  void share_hash();
+  void unlink_hash();
+  void resize_hash();
 
   void handle_error(const char * error_str, const Token& token)
   {
@@ -297,5 +297,21 @@ const depth_t MaxPly = 128;
 
 #if defined(_MSC_VER) && defined(_WIN64) && defined(NDEBUG)
 #define USE_INTRIN
+#elif defined(__GNUC__)
+#define USE_BUILTINS
+#endif
+
+// Hot kernels compiled for several instruction sets, picked at startup by
+// the CPU they run on (see cpu.h). Needs the GCC/Clang target pragmas
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USE_CPU_DISPATCH
+#endif
+
+// Slider attacks indexed by the BMI2 instruction pext (see pext.h), on
+// builds for CPUs that have it. Pext is slow on AMD before Zen 3: there,
+// define NO_PEXT to build with the magics only, or run with YAKA_CPU=popcnt
+// to use the magics of a pext build
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#define USE_PEXT
 #endif
 #endif
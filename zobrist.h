@@ -2,15 +2,38 @@
 #define INC_ZOBRIST_H_
 
 #include "yaka.h"
+#include "random.h"
 
 namespace Zobrist {
   const key_t SideHash = 0xE6CD8F029262BE63ULL;
 
-  extern key_t PieceHash[Piece::PIECE_NB][Square::SQ_NB];
-  extern key_t CastlingHash[Castling::CASTLING_RIGHT_NB];
-  extern key_t EpHash[Square::SQ_NB];
+  struct Keys {
+    key_t piece[Piece::PIECE_NB][Square::SQ_NB];
+    key_t castling[Castling::CASTLING_RIGHT_NB];
+    key_t ep[Square::SQ_NB];
+  };
+
+  // The keys are generated at compile time, drawn from Random's generator
+  // and seed in the same order as they used to be at startup, so they are
+  // the same as before (and hash files stay valid)
+  constexpr Keys generate_keys()
+  {
+    Keys k = {};
+    uint64_t s = Random::Seed;
+    for (int pc = Piece::WHITE_PAWN; pc <= Piece::BLACK_KING; ++pc)
+      for (int sq = Square::A1; sq < Square::SQ_NB; ++sq) {
+        k.piece[pc][sq] = Random::xorshift64star(s);
+        k.ep[sq] ^= Random::xorshift64star(s);
+        k.castling[sq % Castling::CASTLING_RIGHT_NB] ^= Random::xorshift64star(s);
+      }
+    return k;
+  }
+
+  constexpr Keys AllKeys = generate_keys();
+  static constexpr const key_t (&PieceHash)[Piece::PIECE_NB][Square::SQ_NB] = AllKeys.piece;
+  static constexpr const key_t (&CastlingHash)[Castling::CASTLING_RIGHT_NB] = AllKeys.castling;
+  static constexpr const key_t (&EpHash)[Square::SQ_NB] = AllKeys.ep;
 
-  void init();
   inline key_t hash(Piece::Type pc, Square::Type from, Square::Type to)
   {
     return PieceHash[pc][from] ^ PieceHash[pc][to];